@@ -5,6 +5,7 @@
 #import "ARCalibrator.h"
 #import "AREnvironmentBuilder.h"
 #import "ARLightProbeSampler.h"
+#import "ARPrefilteredEnvironment.h"
 #import "ARMarkerPoseTracker.h"
 #import "ARPoseTracker.h"
 #import "ARToneMapper.h"
@@ -2,6 +2,10 @@
 // Licensing information can be found in the LICENSE file.
 // (C) 2015 Nandor Licker. All rights reserved.
 
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iomanip>
 
 #include <fcntl.h>
@@ -10,6 +14,7 @@
 #include <ceres/ceres.h>
 
 #include "ar/ArUcoTracker.h"
+#include "ar/MarkerResiduals.h"
 #include "ar/Rotation.h"
 
 namespace ar {
@@ -36,8 +41,64 @@ const Eigen::Matrix<double, 4, 4> kC = (Eigen::Matrix<double, 4, 4>() <<
      0,  0, -1,  0,
      0,  0,  0,  1
 ).finished();
-/// Maximum scene size.
-constexpr float kMaxDistance = 1000.0f;
+/// Number of frames between full frame searches while markers are tracked.
+constexpr size_t kSearchInterval = 15;
+/// Minimal padding of predicted marker regions, in pixels.
+constexpr int kMinPadding = 16;
+/// If predicted regions cover more than this fraction, the full frame is searched.
+constexpr float kMaxRegionArea = 0.5f;
+/// Number of frames corners are tracked for between detections.
+constexpr size_t kDetectInterval = 5;
+/// Size of the optical flow window.
+constexpr int kFlowWindow = 21;
+/// Number of optical flow pyramid levels.
+constexpr int kFlowLevels = 3;
+/// Maximal optical flow error of tracked corners.
+constexpr float kMaxFlowError = 20.0f;
+/// Markers closer than this to the border might be leaving the view.
+constexpr int kBorder = 8;
+/// Number of iterations refining the pose of frames with tracked corners.
+constexpr int kRefineIterations = 10;
+/// Step used to differentiate the reprojection error numerically.
+constexpr double kRefineStep = 1e-6;
+/// Refined poses with a larger RMS reprojection error are solved with RANSAC.
+constexpr double kMaxRefineError = 2.0;
+/// Number of most recent poses optimized by bundle adjustment.
+constexpr size_t kWindowSize = 10;
+/// Number of older poses fixed to anchor the window.
+constexpr size_t kMaxFixedPoses = 20;
+/// Maximal time spent in a single bundle adjustment run, in seconds.
+constexpr double kMaxSolverTime = 0.1;
+/// Interval between estimating the uncertainty of markers and saving the map, in seconds.
+constexpr double kSaveInterval = 5.0;
+/// Poses whose markers are all seen from this many other poses are redundant.
+constexpr size_t kRedundantViews = 3;
+/// Identifies marker map files.
+constexpr uint32_t kMapMagic = 0x4D524B41;
+/// Version of the marker map file format.
+constexpr uint32_t kMapVersion = 2;
+/// Stored markers with a larger position variance must be discovered again.
+constexpr float kMaxVariance = 1.0f;
+
+/**
+ Header of the marker map file.
+ */
+struct MapHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t reference;
+  uint32_t count;
+};
+
+/**
+ Serialized marker, with the upper triangle of the covariance.
+ */
+struct MarkerRecord {
+  int32_t id;
+  float t[3];
+  float q[4];
+  float covariance[6];
+};
 
 template<typename T>
 Eigen::Matrix<T, 4, 4> Compose(const Eigen::Quaternion<T> &q, const Eigen::Matrix<T, 3, 1> &t) {
@@ -73,319 +134,223 @@ class Silence {
   int temp_;
 };
 
-/**
- Residual block for both marker and pose.
- */
-struct MarkerResidual {
- public:
-  const Eigen::Matrix<double, 4, 4> p;
-  const Eigen::Matrix<double, 4, 4> &k;
-  const std::vector<cv::Point2f> &corners;
-
-  MarkerResidual(
-      const Eigen::Matrix<double, 4, 4> &k,
-      const Eigen::Matrix<double, 3, 1> &t,
-      const Eigen::Quaternion<double> &q,
-      const std::vector<cv::Point2f> &corners)
-    : p(Compose(q, t))
-    , k(k)
-    , corners(corners)
-  {
-    assert(corners.size() == 4);
-  }
-
-  template<typename T>
-  bool operator() (
-      const T *const pmt,
-      const T *const pmq,
-      T *pr) const
-  {
-    // Map inputs: pose rotation + translation.
-    Eigen::Map<const Eigen::Matrix<T, 3, 1>> mt(pmt);
-    Eigen::Map<const Eigen::Quaternion<T>> mq(pmq);
-
-    // Compose the marker matrix.
-    Eigen::Matrix<T, 4, 4> m = Eigen::Matrix<T, 4, 4>::Identity();
-    m.block(0, 0, 3, 3) = mq.toRotationMatrix();
-    m.block(0, 3, 3, 1) = mt;
-
-    if (mt.norm() > T(kMaxDistance)) {
-      return false;
-    }
-
-    // Compute outputs: 8 residuals.
-    for (size_t i = 0; i < kGrid.size(); ++i) {
-      const Eigen::Matrix<T, 4, 1> gx(T(kGrid[i].x()), T(kGrid[i].y()), T(kGrid[i].z()), T(1));
-
-      const Eigen::Matrix<T, 4, 1> x = k.cast<T>() * p.cast<T>() * m * gx;
-      pr[i * 2 + 0] = x.x() / x.z() - T(corners[i].x);
-      pr[i * 2 + 1] = x.y() / x.z() - T(corners[i].y);
-    }
-
-    return true;
-  }
-};
-
-
-/**
- Residual block for marker + pose.
- */
-struct MarkerPoseResidual {
- public:
-  const Eigen::Matrix<double, 4, 4> k;
-  const std::vector<cv::Point2f> &corners;
-
-  MarkerPoseResidual(
-      const Eigen::Matrix<double, 4, 4> &k,
-      const std::vector<cv::Point2f> &corners)
-    : k(k)
-    , corners(corners)
-  {
-    assert(corners.size() == kGrid.size());
-  }
-
-  template<typename T>
-  bool operator() (
-      const T *const ppt,
-      const T *const ppq,
-      const T *const pmt,
-      const T *const pmq,
-      T *pr) const
-  {
-    // Map inputs: pose rotation + translation.
-    Eigen::Map<const Eigen::Matrix<T, 3, 1>> pt(ppt);
-    Eigen::Map<const Eigen::Quaternion<T>> pq(ppq);
-    Eigen::Map<const Eigen::Matrix<T, 3, 1>> mt(pmt);
-    Eigen::Map<const Eigen::Quaternion<T>> mq(pmq);
-
-    // Compose the marker matrix.
-    Eigen::Matrix<T, 4, 4> m = Eigen::Matrix<T, 4, 4>::Identity();
-    m.block(0, 0, 3, 3) = mq.toRotationMatrix();
-    m.block(0, 3, 3, 1) = mt;
-    // Compose the pose matrix.
-    Eigen::Matrix<T, 4, 4> p = Eigen::Matrix<T, 4, 4>::Identity();
-    p.block(0, 0, 3, 3) = pq.toRotationMatrix();
-    p.block(0, 3, 3, 1) = pt;
-
-    if (mt.norm() > T(kMaxDistance) || pt.norm() > T(kMaxDistance)) {
-      return false;
-    }
-
-    // Compute outputs: 8 residuals.
-    for (size_t i = 0; i < kGrid.size(); ++i) {
-      const Eigen::Matrix<T, 4, 1> gx(T(kGrid[i].x()), T(kGrid[i].y()), T(kGrid[i].z()), T(1));
-
-      const Eigen::Matrix<T, 4, 1> x = k.cast<T>() * p * m * gx;
-      pr[i * 2 + 0] = x.x() / x.z() - T(corners[i].x);
-      pr[i * 2 + 1] = x.y() / x.z() - T(corners[i].y);
-    }
-
-    return true;
-  }
-};
-
-
-/**
- Residual for pose only.
- */
-struct PoseResidual {
- public:
-  const Eigen::Matrix<double, 4, 4> m;
-  const Eigen::Matrix<double, 4, 4> &k;
-  const std::vector<cv::Point2f> &corners;
-
-  PoseResidual(
-      const Eigen::Matrix<double, 4, 4> &k,
-      const Eigen::Matrix<double, 3, 1> &t,
-      const Eigen::Quaternion<double> &q,
-      const std::vector<cv::Point2f> &corners)
-    : m(Compose(q, t))
-    , k(k)
-    , corners(corners)
-  {
-    assert(corners.size() == 4);
-  }
-
-  template<typename T>
-  bool operator() (
-      const T *const ppt,
-      const T *const ppq,
-      T *pr) const
-  {
-    // Map inputs: pose rotation + translation.
-    Eigen::Map<const Eigen::Matrix<T, 3, 1>> pt(ppt);
-    Eigen::Map<const Eigen::Quaternion<T>> pq(ppq);
-
-    // Compose the marker matrix.
-    Eigen::Matrix<T, 4, 4> p = Eigen::Matrix<T, 4, 4>::Identity();
-    p.block(0, 0, 3, 3) = pq.toRotationMatrix();
-    p.block(0, 3, 3, 1) = pt;
-
-    if (pt.norm() > T(kMaxDistance)) {
-      return false;
-    }
-
-    // Compute outputs: 8 residuals.
-    for (size_t i = 0; i < kGrid.size(); ++i) {
-      const Eigen::Matrix<T, 4, 1> gx(T(kGrid[i].x()), T(kGrid[i].y()), T(kGrid[i].z()), T(1));
-
-      const Eigen::Matrix<T, 4, 1> x = k.cast<T>() * p * m.cast<T>() * gx;
-      pr[i * 2 + 0] = x.x() / x.z() - T(corners[i].x);
-      pr[i * 2 + 1] = x.y() / x.z() - T(corners[i].y);
-    }
-    
-    return true;
-  }
-};
-
-
-std::vector<Eigen::Matrix<double, 3, 1>> ArUcoTracker::Marker::world() const {
-  std::vector<Eigen::Matrix<double, 3, 1>> world;
-  for (const auto &g : kGrid) {
-    world.push_back(q.toRotationMatrix() * g + t);
+std::array<Eigen::Matrix<double, 3, 1>, 4> ArUcoTracker::Marker::world() const {
+  std::array<Eigen::Matrix<double, 3, 1>, 4> world;
+  const auto r = q.toRotationMatrix();
+  for (size_t i = 0; i < kGrid.size(); ++i) {
+    world[i] = r * kGrid[i] + t;
   }
   return world;
 }
 
 
-ArUcoTracker::ArUcoTracker(const cv::Mat k, const cv::Mat d)
+ArUcoTracker::ArUcoTracker(
+    const cv::Mat k,
+    const cv::Mat d,
+    const std::string &map,
+    size_t maxPoses)
   : Tracker(k, d)
   , dict_(cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250))
   , params_(new cv::aruco::DetectorParameters())
+  , detector_(dict_, params_)
+  , mapPath_(map)
   , reference_(kNumMarkers)
+  , posesAdded_(0)
+  , maxPoses_(std::max(maxPoses, kWindowSize))
+  , markers_(std::make_shared<MarkerMap>())
   , running_(true)
   , thread_(&ArUcoTracker::RunBundleAdjustment, this)
+  , flow_(kFlowWindow, kFlowLevels)
+  , detections_(0)
+  , hasPrevPose_(false)
+  , framesSinceSearch_(0)
+  , framesSinceDetection_(0)
 {
+  observers_.fill(0);
+
+  // Missing distortion coefficients are zero.
+  dist_.fill(0.0);
+  for (size_t i = 0; i < std::min(dist_.size(), d.total()); ++i) {
+    dist_[i] = d.type() == CV_32F ? d.at<float>(i) : d.at<double>(i);
+  }
+
+  if (!mapPath_.empty()) {
+    LoadMap();
+  }
 }
 
 
 ArUcoTracker::~ArUcoTracker() {
+  StopPipeline();
+
   running_ = false;
   cond_.notify_all();
   thread_.join();
 }
 
 
-Tracker::TrackingResult ArUcoTracker::TrackFrameImpl(
-    const cv::Mat &frame,
+void ArUcoTracker::Detect(const cv::Mat &frame, double time, Observation &observation) {
+  // Detect the markers & find their corners. Buffers are reused across
+  // frames, so frames which only track known markers do not allocate.
+  observation.tracked = DetectMarkers(frame, time, observation.ids);
+  observation.corners = markersCorners_;
+}
+
+
+Tracker::TrackingResult ArUcoTracker::Solve(
+    const Observation &observation,
     float dt)
 {
-  // Detect the markers & find their corners.
-  std::vector<int> ids;
-  cv::aruco::detectMarkers(frame, dict_, markersCorners_, ids, params_);
+  const auto &ids = observation.ids;
+  const auto &corners = observation.corners;
+  {
+    std::lock_guard<std::mutex> lock(trackingMutex_);
+    solvedCorners_ = corners;
+  }
   if (ids.empty()) {
+    hasPrevPose_ = false;
     return { false, {}, {} };
   }
 
   // If no markers were discovered yet, fix the coorinate system's origin to
   // the centre of the first marker that is detected.
-  if (reference_ >= kNumMarkers) {
-    std::lock_guard<std::mutex> lock(markerMutex_);
-    markers_[ids[0]].found = true;
-    reference_ = ids[0];
+  // The reference is set before the marker is published, so bundle
+  // adjustment never sees it as an ordinary marker.
+  if (reference_ >= static_cast<MarkerID>(kNumMarkers)) {
+    const MarkerID reference = ids[0];
+    reference_ = reference;
+    UpdateMarkers([&](MarkerMap &map) { map[reference].found = true; });
   }
 
+  // Take a snapshot of the markers, which is not modified while in use.
+  const auto snapshot = std::atomic_load(&markers_);
+  const auto &markers = *snapshot;
+
   // If none of the markers are connected to already seen ones, bail out.
   {
     bool found = false;
     for (const auto &id : ids) {
-      if (markers_[id].found) {
+      if (markers[id].found) {
         found = true;
         break;
       }
     }
     if (!found) {
+      hasPrevPose_ = false;
       return { false, {}, {} };
     }
   }
 
-  // Find the pose using RANSAC based on point correspondendes from known markers.
+  // Find the pose from point correspondences with known markers.
   Eigen::Quaternion<double> q;
   Eigen::Matrix<double, 3, 1> t;
-  std::unordered_set<int> inliers;
+  auto &inliers = inliers_;
   {
-    std::vector<cv::Point3f> world;
-    std::vector<cv::Point2f> image;
-    std::vector<int> markerID;
+    auto &world = world_;
+    auto &image = image_;
+    auto &markerID = markerID_;
+    world.clear();
+    image.clear();
+    markerID.clear();
+    inliers.clear();
 
     for (size_t i = 0; i < ids.size(); ++i) {
       // OpenCV never disappoints.
-      assert(markersCorners_[i].size() == 4);
+      assert(corners[i].size() == 4);
 
       // Fetch the marker from the database.
-      if (!markers_[ids[i]].found) {
+      if (!markers[ids[i]].found) {
         continue;
       }
 
       // Fetch the markerse.
-      const auto object = markers_[ids[i]].world();
+      const auto object = markers[ids[i]].world();
 
       // Array to recover inlier IDs from.
       markerID.push_back(ids[i]);
 
       // Fetch the world-image correspondences.
-      assert(object.size() == markersCorners_[i].size());
-      for (size_t j = 0; j < markersCorners_[i].size(); ++j) {
+      assert(object.size() == corners[i].size());
+      for (size_t j = 0; j < corners[i].size(); ++j) {
         world.emplace_back(object[j].x(), object[j].y(), object[j].z());
-        image.push_back(markersCorners_[i][j]);
+        image.push_back(corners[i][j]);
       }
     }
 
-    // Apply RANSAC with EPNP to find the pose. If not enough markers are available,
-    // the P3P algorithm is applied on 4 points for a single marker.
-    std::vector<int> inlierCorners;
-    cv::Mat rvec, tvec;
-    bool success;
-    if (world.size() == 4) {
-      success = cv::solvePnP(
-          world, image,
-          k, d,
-          rvec, tvec,
-          false,
-          CV_P3P
-      );
-      inliers = { markerID[0] };
+    // If corners were tracked, the pose is close to the previous one, so it
+    // is refined instead of being solved with RANSAC, which allocates.
+    bool refined = false;
+    if (observation.tracked && hasPrevPose_) {
+      q = prevQ_;
+      t = prevT_;
+      refined = RefinePose(world, image, q, t) <= kMaxRefineError;
+    }
+
+    if (refined) {
+      inliers.assign(markerID.begin(), markerID.end());
     } else {
-      success = cv::solvePnPRansac(
-          world, image,
-          k, d,
-          rvec, tvec,
-          false,
-          50,
-          1.0f,
-          0.99f,
-          inlierCorners,
-          CV_EPNP
-      );
-      for (const auto &cornerID : inlierCorners) {
-        inliers.insert(markerID[cornerID / 4]);
+      // Apply RANSAC with EPNP to find the pose. If not enough markers are available,
+      // the P3P algorithm is applied on 4 points for a single marker.
+      auto &inlierCorners = inlierCorners_;
+      auto &rvec = rvec_;
+      auto &tvec = tvec_;
+      bool success;
+      if (world.size() == 4) {
+        success = cv::solvePnP(
+            world, image,
+            k, d,
+            rvec, tvec,
+            false,
+            CV_P3P
+        );
+        inliers.push_back(markerID[0]);
+      } else {
+        success = cv::solvePnPRansac(
+            world, image,
+            k, d,
+            rvec, tvec,
+            false,
+            50,
+            1.0f,
+            0.99f,
+            inlierCorners,
+            CV_EPNP
+        );
+        for (const auto &cornerID : inlierCorners) {
+          inliers.push_back(markerID[cornerID / 4]);
+        }
+        std::sort(inliers.begin(), inliers.end());
+        inliers.erase(std::unique(inliers.begin(), inliers.end()), inliers.end());
+      }
+      if (!success) {
+        hasPrevPose_ = false;
+        return { false, {}, {} };
       }
-    }
-    if (!success) {
-      return { false, {}, {} };
-    }
 
-    // Convert result to Eigen.
-    Eigen::Matrix<double, 3, 1> r;
-    r(0, 0) = rvec.at<double>(0, 0);
-    r(1, 0) = rvec.at<double>(1, 0);
-    r(2, 0) = rvec.at<double>(2, 0);
-    q = Eigen::AngleAxis<double>{ r.norm(), r.normalized() },
-    t = { tvec.at<double>(0, 0), tvec.at<double>(1, 0), tvec.at<double>(2, 0) };
+      // Convert result to Eigen.
+      Eigen::Matrix<double, 3, 1> r;
+      r(0, 0) = rvec.at<double>(0, 0);
+      r(1, 0) = rvec.at<double>(1, 0);
+      r(2, 0) = rvec.at<double>(2, 0);
+      q = Eigen::AngleAxis<double>{ r.norm(), r.normalized() },
+      t = { tvec.at<double>(0, 0), tvec.at<double>(1, 0), tvec.at<double>(2, 0) };
+    }
+    prevQ_ = q;
+    prevT_ = t;
+    hasPrevPose_ = true;
   }
 
   // Iterate again and find the new markers. Express their position in the global
   // coordinate system of the markers. If new markers were added, perform bundle adjustment.
   // Concurrently, create an optimization problem to fix all the new poses concurrently.
-  ceres::Problem problem;
-  ceres::LocalParameterization *qsParam = new QuaternionParametrization();
+  std::unordered_map<MarkerID, Marker> discovered;
   for (size_t i = 0; i < ids.size(); ++i) {
-    if (markers_[ids[i]].found) {
+    if (markers[ids[i]].found) {
       continue;
     }
 
     // Locate the camera relative to the marker.
-    auto r = solvePnP(kGrid, markersCorners_[i]);
+    auto r = solvePnP(kGrid, corners[i]);
     if (!std::get<2>(r)) {
       continue;
     }
@@ -399,50 +364,50 @@ Tracker::TrackingResult ArUcoTracker::TrackFrameImpl(
     Eigen::Quaterniond mq(P.block<3, 3>(0, 0));
 
     // Add the measurement to the list.
-    assert(markers_[ids[i]].mq.size() == markers_[ids[i]].mt.size());
-    if (markers_[ids[i]].mq.size() < 5) {
-      markers_[ids[i]].mq.push_back(mq);
-      markers_[ids[i]].mt.push_back(mt);
+    auto &measuredQ = measuredQ_[ids[i]];
+    auto &measuredT = measuredT_[ids[i]];
+    assert(measuredQ.size() == measuredT.size());
+    if (measuredQ.size() < 5) {
+      measuredQ.push_back(mq);
+      measuredT.push_back(mt);
     }
 
     // If enough measurements were made, find the pose.
-    if (markers_[ids[i]].mq.size() >= 5) {
-
-      // Create the marker in the hash map.
-      {
-        std::lock_guard<std::mutex> lock(markerMutex_);
-        markers_[ids[i]].found = true;
-        markers_[ids[i]].t = VectorMedian<double, 3>(markers_[ids[i]].mt);
-        markers_[ids[i]].q = QuaternionAverage<double>(markers_[ids[i]].mq);
-
-        std::cout
-            << "Discovered: " << std::endl
-            << ids[i] << " "
-            << markers_[ids[i]].t.transpose() << " "
-            << markers_[ids[i]].q.coeffs().transpose()
-            << std::endl;
+    if (measuredQ.size() >= 5) {
+
+      // Create the marker, published after refinement.
+      auto &marker = discovered[ids[i]];
+      marker.found = true;
+      marker.t = VectorMedian<double, 3>(measuredT);
+      marker.q = QuaternionAverage<double>(measuredQ);
+
+      std::cout
+          << "Discovered: " << std::endl
+          << ids[i] << " "
+          << marker.t.transpose() << " "
+          << marker.q.coeffs().transpose()
+          << std::endl;
+    }
+  }
 
+  // Refine the discovered markers. The problem is only created if needed.
+  if (!discovered.empty()) {
+    ceres::Problem problem;
+    ceres::LocalParameterization *qsParam = new QuaternionParametrization();
+    for (size_t i = 0; i < ids.size(); ++i) {
+      auto it = discovered.find(ids[i]);
+      if (it == discovered.end()) {
+        continue;
       }
-
-      // Add the marker to the list of markers.
+      auto &marker = it->second;
       problem.AddResidualBlock(
-          new ceres::AutoDiffCostFunction<MarkerResidual, 8, 3, 4>(new MarkerResidual(
-              K,
-              t,
-              q,
-              markersCorners_[i]
-          )),
+          new MarkerResidual(K, t, q, kGrid, corners[i]),
           nullptr,
-          markers_[ids[i]].t.data(),
-          markers_[ids[i]].q.coeffs().data()
+          marker.t.data(),
+          marker.q.coeffs().data()
       );
-      problem.SetParameterization(markers_[ids[i]].q.coeffs().data(), qsParam);
+      problem.SetParameterization(marker.q.coeffs().data(), qsParam);
     }
-  }
-
-  // Make sure that the quaternion is of unit length.
-  if (problem.NumResidualBlocks() > 0) {
-    std::lock_guard<std::mutex> lock(markerMutex_);
 
     ceres::Solver::Summary summary;
     ceres::Solver::Options options;
@@ -459,34 +424,25 @@ Tracker::TrackingResult ArUcoTracker::TrackFrameImpl(
     }
   }
 
+  // Publish the discovered markers.
+  if (!discovered.empty()) {
+    UpdateMarkers([&](MarkerMap &map) {
+      for (const auto &marker : discovered) {
+        map[marker.first] = marker.second;
+      }
+    });
+  }
+
   // Check if the current pose is worth adding to the previous poses.
   {
     std::unique_lock<std::mutex> lock(poseMutex_);
 
-    bool addPose = true;
-    std::unordered_set<MarkerID> allMarkers;
-
-    for (const auto &pose : poses_) {
-      for (const auto &obs : pose.observed) {
-        allMarkers.insert(obs.first);
-      }
-
-      // Ensure the poses are far enough from each other.
-      if ((pose.t - t).norm() > kMinDistance) {
-        continue;
-      }
-      if (std::abs(Angle(pose.q * q.inverse())) > kMinAngle) {
-        continue;
-      }
-
-      // If not, skip adding the pose.
-      addPose = false;
-      break;
-    }
+    // Ensure the poses are far enough from each other.
+    bool addPose = !HasNearbyPose(q, t);
 
     // Add the pose if it contains a marker not yet discovered.
     for (const auto &id : ids) {
-      if (allMarkers.find(id) == allMarkers.end()) {
+      if (observers_[id] == 0) {
         addPose = true;
       }
     }
@@ -498,7 +454,7 @@ Tracker::TrackingResult ArUcoTracker::TrackFrameImpl(
     }
 
     if (addPose) {
-      poses_.emplace_back(t, q, ids, markersCorners_);
+      AddPose(q, t, ids, corners);
       lock.unlock();
       cond_.notify_all();
     }
@@ -511,6 +467,188 @@ Tracker::TrackingResult ArUcoTracker::TrackFrameImpl(
   };
 }
 
+bool ArUcoTracker::DetectMarkers(const cv::Mat &frame, double time, std::vector<int> &ids) {
+  // Build the pyramid for corner tracking, reusing the buffers of the frame
+  // before the previous one.
+  flow_.AddFrame(frame);
+
+  // In between detections, follow the corners of the markers.
+  if (framesSinceDetection_ < kDetectInterval && TrackCorners(frame.size(), ids)) {
+    ++framesSinceDetection_;
+    ++framesSinceSearch_;
+    return true;
+  }
+  framesSinceDetection_ = 0;
+  ++detections_;
+
+  // Search regions around the markers if they are tracked.
+  auto &regions = regions_;
+  regions.clear();
+  if (framesSinceSearch_ < kSearchInterval) {
+    PredictRegions(frame.size(), time, regions);
+  }
+
+  ids.clear();
+  if (!regions.empty()) {
+    ++framesSinceSearch_;
+
+    auto &corners = detectedCorners_;
+    auto &regionCorners = regionCorners_;
+    auto &regionIDs = regionIDs_;
+    corners.clear();
+    for (const auto &region : regions) {
+      // Regions only contain known markers, so the image can be downscaled
+      // for candidate search based on the size they are expected at.
+      detector_(frame(region.rect), region.scale, regionCorners, regionIDs);
+      for (size_t i = 0; i < regionIDs.size(); ++i) {
+        // Regions might overlap, so a marker might be found multiple times.
+        if (std::find(ids.begin(), ids.end(), regionIDs[i]) != ids.end()) {
+          continue;
+        }
+        for (auto &corner : regionCorners[i]) {
+          corner.x += region.rect.x;
+          corner.y += region.rect.y;
+        }
+        ids.push_back(regionIDs[i]);
+        corners.push_back(regionCorners[i]);
+      }
+    }
+    std::swap(markersCorners_, corners);
+    if (!ids.empty()) {
+      markerIDs_ = ids;
+      return false;
+    }
+  }
+
+  // Fall back to the full frame periodically, to find new markers, or if
+  // the markers were lost. New markers can be smaller than the tracked ones,
+  // so the frame is searched at full resolution.
+  framesSinceSearch_ = 0;
+  detector_(frame, 1.0f, markersCorners_, ids);
+  markerIDs_ = ids;
+  return false;
+}
+
+bool ArUcoTracker::TrackCorners(const cv::Size &size, std::vector<int> &ids) {
+  if (markerIDs_.empty() || !flow_.HasPrevious()) {
+    return false;
+  }
+
+  // Track all corners at once.
+  flowPrev_.clear();
+  for (const auto &corners : markersCorners_) {
+    flowPrev_.insert(flowPrev_.end(), corners.begin(), corners.end());
+  }
+  flow_.Track(flowPrev_, flowNext_, flowStatus_, flowError_);
+
+  // If any of the markers is lost, deformed or leaving the view, detect
+  // markers again, also finding the ones coming into view.
+  const cv::Rect inner(kBorder, kBorder, size.width - 2 * kBorder, size.height - 2 * kBorder);
+  auto &tracked = trackedCorners_;
+  tracked.resize(flowNext_.size() / 4);
+  for (size_t i = 0; i < flowNext_.size(); i += 4) {
+    for (size_t j = i; j < i + 4; ++j) {
+      if (!flowStatus_[j] || flowError_[j] > kMaxFlowError || !inner.contains(flowNext_[j])) {
+        return false;
+      }
+    }
+    auto &corners = tracked[i / 4];
+    corners.assign(flowNext_.begin() + i, flowNext_.begin() + i + 4);
+    if (!cv::isContourConvex(corners)) {
+      return false;
+    }
+  }
+
+  // Swap the buffers, keeping both sets of corners allocated.
+  std::swap(markersCorners_, tracked);
+  ids = markerIDs_;
+  return true;
+}
+
+void ArUcoTracker::PredictRegions(
+    const cv::Size &size,
+    double time,
+    std::vector<Region> &regions)
+{
+  const cv::Rect bounds(0, 0, size.width, size.height);
+
+  // Adds a padded box around the corners of a marker, merging it with
+  // overlapping ones. Merged regions are scaled for their smallest marker.
+  auto add = [&](const cv::Point2f *points, size_t count) {
+    float x0 = points[0].x, y0 = points[0].y, x1 = x0, y1 = y0;
+    for (size_t i = 1; i < count; ++i) {
+      x0 = std::min(x0, points[i].x);
+      y0 = std::min(y0, points[i].y);
+      x1 = std::max(x1, points[i].x);
+      y1 = std::max(y1, points[i].y);
+    }
+    cv::Rect box(
+        cvFloor(x0),
+        cvFloor(y0),
+        cvFloor(x1) - cvFloor(x0) + 1,
+        cvFloor(y1) - cvFloor(y0) + 1
+    );
+    const int pad = std::max(kMinPadding, std::max(box.width, box.height) / 2);
+    box = cv::Rect(box.x - pad, box.y - pad, box.width + 2 * pad, box.height + 2 * pad);
+    box &= bounds;
+    if (box.area() == 0) {
+      return;
+    }
+    const float scale = MarkerDetector::Scale(points, count);
+    for (auto &region : regions) {
+      if ((region.rect & box).area() > 0) {
+        region.rect |= box;
+        region.scale = std::min(region.scale, scale);
+        return;
+      }
+    }
+    regions.push_back({ box, scale });
+  };
+
+  // Markers are expected close to where they were in the previous frame.
+  for (const auto &corners : markersCorners_) {
+    add(corners.data(), corners.size());
+  }
+
+  // Markers with known positions are projected using the pose the filter
+  // predicts for the frame, which integrated the IMU samples since the last
+  // tracked frame. This also finds markers entering the view.
+  Eigen::Quaternion<float> qf;
+  Eigen::Matrix<float, 3, 1> tf;
+  if (PredictPose(time, qf, tf)) {
+    // Undo the change of axes applied to the tracked poses.
+    const Eigen::Quaternion<double> q(qf.w(), qf.x(), -qf.y(), -qf.z());
+    const Eigen::Matrix<double, 3, 1> t(tf.x(), -tf.y(), -tf.z());
+
+    const auto markers = std::atomic_load(&markers_);
+    for (const auto &marker : *markers) {
+      if (!marker.found) {
+        continue;
+      }
+      const auto world = marker.world();
+      std::array<cv::Point2f, 4> image;
+      bool visible = true;
+      for (size_t i = 0; i < world.size() && visible; ++i) {
+        Eigen::Matrix<double, 2, 1> p;
+        visible = Project(q, t, world[i], p);
+        image[i] = cv::Point2f(p.x(), p.y());
+      }
+      if (visible) {
+        add(image.data(), image.size());
+      }
+    }
+  }
+
+  // Searching small regions only pays off if they are small.
+  int area = 0;
+  for (const auto &region : regions) {
+    area += region.rect.area();
+  }
+  if (area > kMaxRegionArea * bounds.area()) {
+    regions.clear();
+  }
+}
+
 std::tuple<Eigen::Quaternion<double>, Eigen::Matrix<double, 3, 1>, bool> ArUcoTracker::solvePnP(
     const std::vector<Eigen::Matrix<double, 3, 1>> &world,
     const std::vector<cv::Point2f> &image)
@@ -548,49 +686,241 @@ std::tuple<Eigen::Quaternion<double>, Eigen::Matrix<double, 3, 1>, bool> ArUcoTr
   };
 }
 
-size_t ArUcoTracker::BundleAdjust() {
+bool ArUcoTracker::Project(
+    const Eigen::Quaternion<double> &q,
+    const Eigen::Matrix<double, 3, 1> &t,
+    const Eigen::Matrix<double, 3, 1> &w,
+    Eigen::Matrix<double, 2, 1> &p) const
+{
+  const Eigen::Matrix<double, 3, 1> c = q * w + t;
+  if (c.z() <= 0.0) {
+    return false;
+  }
+
+  // Radial and tangential distortion, in the order OpenCV stores it.
+  const double x = c.x() / c.z();
+  const double y = c.y() / c.z();
+  const double r2 = x * x + y * y;
+  const double radial = 1.0 + r2 * (dist_[0] + r2 * (dist_[1] + r2 * dist_[4]));
+  const double xd = x * radial + 2.0 * dist_[2] * x * y + dist_[3] * (r2 + 2.0 * x * x);
+  const double yd = y * radial + dist_[2] * (r2 + 2.0 * y * y) + 2.0 * dist_[3] * x * y;
+
+  p.x() = K(0, 0) * xd + K(0, 2);
+  p.y() = K(1, 1) * yd + K(1, 2);
+  return true;
+}
+
+double ArUcoTracker::ReprojectionError(
+    const std::vector<cv::Point3f> &world,
+    const std::vector<cv::Point2f> &image,
+    const Eigen::Quaternion<double> &q,
+    const Eigen::Matrix<double, 3, 1> &t) const
+{
+  double error = 0.0;
+  for (size_t i = 0; i < world.size(); ++i) {
+    Eigen::Matrix<double, 2, 1> p;
+    if (!Project(q, t, { world[i].x, world[i].y, world[i].z }, p)) {
+      return std::numeric_limits<double>::infinity();
+    }
+    error += (p - Eigen::Matrix<double, 2, 1>(image[i].x, image[i].y)).squaredNorm();
+  }
+  return error;
+}
+
+double ArUcoTracker::RefinePose(
+    const std::vector<cv::Point3f> &world,
+    const std::vector<cv::Point2f> &image,
+    Eigen::Quaternion<double> &q,
+    Eigen::Matrix<double, 3, 1> &t) const
+{
+  assert(world.size() == image.size());
+  if (world.empty()) {
+    return std::numeric_limits<double>::infinity();
+  }
 
-  // Create a copy of the markers.
-  std::array<Marker, kNumMarkers> markers;
+  // Poses are updated by a rotation vector, applied in the camera frame,
+  // and a translation.
+  const auto update = [](
+      const Eigen::Quaternion<double> &q,
+      const Eigen::Matrix<double, 3, 1> &t,
+      const Eigen::Matrix<double, 6, 1> &dx,
+      Eigen::Quaternion<double> &uq,
+      Eigen::Matrix<double, 3, 1> &ut)
   {
-    std::lock_guard<std::mutex> lock(markerMutex_);
-    markers = markers_;
+    const Eigen::Matrix<double, 3, 1> r = dx.head<3>();
+    const double angle = r.norm();
+    const Eigen::Quaternion<double> dq = angle > 0.0
+        ? Eigen::Quaternion<double>(Eigen::AngleAxis<double>(angle, r / angle))
+        : Eigen::Quaternion<double>::Identity();
+    uq = (dq * q).normalized();
+    ut = dq * t + dx.tail<3>();
+  };
+
+  double error = ReprojectionError(world, image, q, t);
+  double lambda = 1e-3;
+  for (int it = 0; it < kRefineIterations && std::isfinite(error); ++it) {
+    // Build the normal equations, differentiating numerically.
+    Eigen::Matrix<double, 6, 6> JtJ = Eigen::Matrix<double, 6, 6>::Zero();
+    Eigen::Matrix<double, 6, 1> Jtr = Eigen::Matrix<double, 6, 1>::Zero();
+    bool valid = true;
+    for (size_t i = 0; i < world.size() && valid; ++i) {
+      const Eigen::Matrix<double, 3, 1> w(world[i].x, world[i].y, world[i].z);
+      Eigen::Matrix<double, 2, 1> p;
+      valid = Project(q, t, w, p);
+
+      Eigen::Matrix<double, 2, 6> J;
+      for (int j = 0; j < 6 && valid; ++j) {
+        Eigen::Matrix<double, 6, 1> dx = Eigen::Matrix<double, 6, 1>::Zero();
+        dx(j) = kRefineStep;
+        Eigen::Quaternion<double> uq;
+        Eigen::Matrix<double, 3, 1> ut;
+        update(q, t, dx, uq, ut);
+        Eigen::Matrix<double, 2, 1> up;
+        valid = Project(uq, ut, w, up);
+        J.col(j) = (up - p) / kRefineStep;
+      }
+
+      const Eigen::Matrix<double, 2, 1> r = p - Eigen::Matrix<double, 2, 1>(image[i].x, image[i].y);
+      JtJ += J.transpose() * J;
+      Jtr += J.transpose() * r;
+    }
+    if (!valid) {
+      return std::numeric_limits<double>::infinity();
+    }
+
+    // Damp the step, increasing damping until the error decreases.
+    Eigen::Matrix<double, 6, 6> A = JtJ;
+    A.diagonal() += lambda * JtJ.diagonal();
+    const Eigen::Matrix<double, 6, 1> dx = -A.ldlt().solve(Jtr);
+
+    Eigen::Quaternion<double> uq;
+    Eigen::Matrix<double, 3, 1> ut;
+    update(q, t, dx, uq, ut);
+    const double updated = ReprojectionError(world, image, uq, ut);
+    if (updated < error) {
+      q = uq;
+      t = ut;
+      lambda = std::max(lambda * 0.1, 1e-9);
+      const bool converged = error - updated < 1e-9 * error;
+      error = updated;
+      if (converged) {
+        break;
+      }
+    } else {
+      lambda *= 10.0;
+    }
   }
 
-  // Create the bundle adjustment problem for all the markers and poses.
-  // The pose mutex protects only the vector - data stored in it is modified
-  // only from this thread, so it is safe to unlock after creating the problem.
-  std::list<std::pair<Eigen::Quaterniond, Eigen::Vector3d>> poses;
-  std::set<double*> qsParams;
-  ceres::Problem problem;
+  return std::sqrt(error / world.size());
+}
+
+size_t ArUcoTracker::BundleAdjust(bool estimate) {
+
+  // Select the most recent poses to be optimized, along with older poses
+  // observing the same markers. Older poses are fixed, anchoring the window
+  // to the rest of the map. Poses are modified only from this thread, so they
+  // can be read after unlocking.
+  std::vector<std::list<Pose>::iterator> window, fixed;
+  size_t processed;
   {
     std::lock_guard<std::mutex> lock(poseMutex_);
+    processed = posesAdded_;
+    CullPoses();
 
-    for (auto &pose : poses_) {
-      poses.emplace_back(pose.q, pose.t);
-      qsParams.insert(poses.back().first.coeffs().data());
-
-      for (const auto &obs : pose.observed) {
-        auto &marker = markers[obs.first];
-        problem.AddResidualBlock(
-            new ceres::AutoDiffCostFunction<MarkerPoseResidual, 8, 3, 4, 3, 4>(
-                new MarkerPoseResidual(K, obs.second)
-            ),
-            nullptr,
-            poses.back().second.data(),
-            poses.back().first.coeffs().data(),
-            marker.t.data(),
-            marker.q.coeffs().data()
-        );
-        qsParams.insert(marker.q.coeffs().data());
+    auto it = poses_.end();
+    while (it != poses_.begin() && window.size() < kWindowSize) {
+      window.push_back(--it);
+    }
+    std::unordered_set<MarkerID> observed;
+    for (const auto &pose : window) {
+      for (const auto &obs : pose->observed) {
+        observed.insert(obs.first);
+      }
+    }
+    while (it != poses_.begin() && fixed.size() < kMaxFixedPoses) {
+      --it;
+      for (const auto &obs : it->observed) {
+        if (observed.count(obs.first)) {
+          fixed.push_back(it);
+          break;
+        }
       }
     }
   }
 
-  // Fix the first marker.
+  // Copy the markers seen from the window.
+  const MarkerID reference = reference_;
+  std::unordered_map<MarkerID, Marker> markers;
   {
-    problem.SetParameterBlockConstant(markers[reference_].q.coeffs().data());
-    problem.SetParameterBlockConstant(markers[reference_].t.data());
+    const auto snapshot = std::atomic_load(&markers_);
+    for (const auto &pose : window) {
+      for (const auto &obs : pose->observed) {
+        markers.emplace(obs.first, (*snapshot)[obs.first]);
+      }
+    }
+  }
+
+  // Copy the poses. The vector is not resized, so pointers to poses are stable.
+  std::vector<std::pair<Eigen::Quaterniond, Eigen::Vector3d>> poses;
+  poses.reserve(window.size() + fixed.size());
+  for (const auto &pose : window) {
+    poses.emplace_back(pose->q, pose->t);
+  }
+  for (const auto &pose : fixed) {
+    poses.emplace_back(pose->q, pose->t);
+  }
+
+  // Create the bundle adjustment problem over the window.
+  std::set<double*> qsParams;
+  ceres::Problem problem;
+  for (size_t i = 0; i < poses.size(); ++i) {
+    const auto &pose = i < window.size() ? window[i] : fixed[i - window.size()];
+    auto &q = poses[i].first;
+    auto &t = poses[i].second;
+
+    bool added = false;
+    for (const auto &obs : pose->observed) {
+      auto it = markers.find(obs.first);
+      if (it == markers.end()) {
+        continue;
+      }
+      auto &marker = it->second;
+      problem.AddResidualBlock(
+          new MarkerPoseResidual(K, kGrid, obs.second),
+          nullptr,
+          t.data(),
+          q.coeffs().data(),
+          marker.t.data(),
+          marker.q.coeffs().data()
+      );
+      qsParams.insert(marker.q.coeffs().data());
+      added = true;
+    }
+
+    if (!added) {
+      continue;
+    }
+    if (i < window.size()) {
+      qsParams.insert(q.coeffs().data());
+    } else {
+      problem.SetParameterBlockConstant(q.coeffs().data());
+      problem.SetParameterBlockConstant(t.data());
+    }
+  }
+
+  // Fix the first marker. Markers restored from the map are refined, kept
+  // close to their restored positions by their uncertainty.
+  for (auto &marker : markers) {
+    if (marker.first == reference) {
+      problem.SetParameterBlockConstant(marker.second.q.coeffs().data());
+      problem.SetParameterBlockConstant(marker.second.t.data());
+    } else if (marker.second.loaded) {
+      problem.AddResidualBlock(
+          new PositionPrior(marker.second.prior, marker.second.priorCovariance),
+          nullptr,
+          marker.second.t.data()
+      );
+    }
   }
 
   // Constrain quaternions to unit length.
@@ -599,7 +929,7 @@ size_t ArUcoTracker::BundleAdjust() {
     problem.SetParameterization(q, qsParam);
   }
 
-  // Solve the problem.
+  // Solve the problem, bounding the time it takes.
   ceres::Solver::Summary summary;
   ceres::Solver::Options options;
   options.use_inner_iterations = true;
@@ -607,6 +937,7 @@ size_t ArUcoTracker::BundleAdjust() {
   options.preconditioner_type = ceres::SCHUR_JACOBI;
   options.linear_solver_type = ceres::ITERATIVE_SCHUR;
   options.max_num_iterations = 30;
+  options.max_solver_time_in_seconds = kMaxSolverTime;
   options.gradient_tolerance = 1e-3;
   options.function_tolerance = 1e-3;
   options.minimizer_progress_to_stdout = false;
@@ -615,58 +946,356 @@ size_t ArUcoTracker::BundleAdjust() {
     ceres::Solve(options, &problem, &summary);
   }
 
-  // Copy back the optimized markers.
-  {
-    std::unique_lock<std::mutex> lock(markerMutex_);
-
-    std::cout << "Optimized:" << std::endl;
-    for (size_t i = 0; i < kNumMarkers; ++i) {
-      if (markers[i].found) {
-        markers_[i].q = markers[i].q;
-        markers_[i].t = markers[i].t;
-
-        std::cout
-            << std::setw(3)  << i << " "
-            << std::setw(5) << markers[i].t.transpose() << " "
-            << std::setw(5) << markers[i].q.coeffs().transpose()
-            << std::endl;
+  // Estimate the uncertainty of the optimized marker positions. This is not
+  // bounded by the solver time, so it is only done when the map is saved.
+  // If the problem is rank deficient, the previous estimates are kept.
+  auto optimized = [&](const std::pair<const MarkerID, Marker> &marker) {
+    return marker.second.found && marker.first != reference;
+  };
+  if (estimate) {
+    std::vector<std::pair<const double*, const double*>> blocks;
+    for (const auto &marker : markers) {
+      if (optimized(marker)) {
+        blocks.emplace_back(marker.second.t.data(), marker.second.t.data());
+      }
+    }
+    ceres::Covariance::Options covOptions;
+    ceres::Covariance covariance(covOptions);
+    if (!blocks.empty() && covariance.Compute(blocks, &problem)) {
+      for (auto &marker : markers) {
+        if (optimized(marker)) {
+          covariance.GetCovarianceBlock(
+              marker.second.t.data(),
+              marker.second.t.data(),
+              marker.second.covariance.data()
+          );
+        }
+      }
+    }
+  }
+
+  // Publish the optimized markers. Markers discovered since the snapshot
+  // was taken are left untouched.
+  UpdateMarkers([&](MarkerMap &map) {
+    for (const auto &marker : markers) {
+      if (marker.second.found) {
+        map[marker.first].q = marker.second.q;
+        map[marker.first].t = marker.second.t;
+        map[marker.first].covariance = marker.second.covariance;
       }
     }
+  });
+
+  std::cout << "Optimized:" << std::endl;
+  for (const auto &marker : markers) {
+    if (marker.second.found) {
+      std::cout
+          << std::setw(3)  << marker.first << " "
+          << std::setw(5) << marker.second.t.transpose() << " "
+          << std::setw(5) << marker.second.q.coeffs().transpose()
+          << std::endl;
+    }
   }
 
-  // Copy the optimized poses.
+  // Copy the optimized poses of the window, moving them in the index.
   {
-    std::unique_lock<std::mutex> lock(poseMutex_);
-    auto pt = poses_.begin();
-    for (const auto &pose : poses) {
-      pt->q = pose.first;
-      pt->t = pose.second;
-      ++pt;
+    std::lock_guard<std::mutex> lock(poseMutex_);
+    for (size_t i = 0; i < window.size(); ++i) {
+      const auto from = Cell(window[i]->t);
+      const auto to = Cell(poses[i].second);
+      if (from != to) {
+        auto &cell = grid_[from];
+        cell.erase(std::find(cell.begin(), cell.end(), window[i]));
+        if (cell.empty()) {
+          grid_.erase(from);
+        }
+        grid_[to].push_back(window[i]);
+      }
+      window[i]->q = poses[i].first;
+      window[i]->t = poses[i].second;
     }
   }
 
-  return poses.size();
+  return processed;
 }
 
 void ArUcoTracker::RunBundleAdjustment() {
 
-  // Track the number of poses processed. Run BA once a new pose arrives.
-  size_t processed = 0;
+  // Track the number of poses processed. Run BA once a new pose arrives,
+  // estimating uncertainties and saving the map periodically.
+  size_t processed = 0, saved = 0;
+  auto lastSave = std::chrono::steady_clock::now();
   while (running_) {
+    size_t added;
     {
       std::unique_lock<std::mutex> lock(poseMutex_);
-      cond_.wait(lock, [&]() { return processed < poses_.size() || !running_; });
+      cond_.wait(lock, [&]() { return processed < posesAdded_ || !running_; });
       if (!running_) {
         break;
       }
+      added = posesAdded_;
+    }
+    std::cout << processed << "/" << added << std::endl;
+
+    const auto now = std::chrono::steady_clock::now();
+    const bool save = !mapPath_.empty() &&
+        std::chrono::duration<double>(now - lastSave).count() >= kSaveInterval;
+    processed = BundleAdjust(save);
+    if (save) {
+      SaveMap(*std::atomic_load(&markers_));
+      saved = processed;
+      lastSave = now;
+    }
+  }
+
+  // Save the poses added since the last save on shutdown.
+  {
+    std::lock_guard<std::mutex> lock(poseMutex_);
+    if (mapPath_.empty() || saved >= posesAdded_) {
+      return;
+    }
+  }
+  BundleAdjust(true);
+  SaveMap(*std::atomic_load(&markers_));
+}
+
+bool ArUcoTracker::HasNearbyPose(
+    const Eigen::Quaterniond &q,
+    const Eigen::Vector3d &t) const
+{
+  // Poses closer than the minimal distance are in neighbouring cells.
+  const Eigen::Vector3d d(kMinDistance, kMinDistance, kMinDistance);
+  for (int x = -1; x <= 1; ++x) {
+    for (int y = -1; y <= 1; ++y) {
+      for (int z = -1; z <= 1; ++z) {
+        auto it = grid_.find(Cell(t + d.cwiseProduct(Eigen::Vector3d(x, y, z))));
+        if (it == grid_.end()) {
+          continue;
+        }
+        for (const auto &pose : it->second) {
+          if ((pose->t - t).norm() > kMinDistance) {
+            continue;
+          }
+          if (std::abs(Angle(pose->q * q.inverse())) > kMinAngle) {
+            continue;
+          }
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void ArUcoTracker::AddPose(
+    const Eigen::Quaterniond &q,
+    const Eigen::Vector3d &t,
+    const std::vector<int> &ids,
+    const std::vector<std::vector<cv::Point2f>> &corners)
+{
+  poses_.emplace_back(t, q, ids, corners);
+  grid_[Cell(t)].push_back(std::prev(poses_.end()));
+  for (const auto &id : ids) {
+    observers_[id]++;
+  }
+  posesAdded_++;
+}
+
+void ArUcoTracker::CullPoses() {
+  if (poses_.size() <= kWindowSize) {
+    return;
+  }
+
+  // Removes a pose from the list and from the index.
+  auto remove = [&](std::list<Pose>::iterator it) {
+    for (const auto &obs : it->observed) {
+      observers_[obs.first]--;
+    }
+    const auto key = Cell(it->t);
+    auto &cell = grid_[key];
+    cell.erase(std::find(cell.begin(), cell.end(), it));
+    if (cell.empty()) {
+      grid_.erase(key);
+    }
+    return poses_.erase(it);
+  };
+
+  // Poses in the window are never removed.
+  const auto window = std::prev(poses_.end(), kWindowSize);
+
+  // Remove poses if all their markers are seen from enough other poses.
+  for (auto it = poses_.begin(); it != window; ) {
+    if (Redundancy(*it) >= kRedundantViews) {
+      it = remove(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // If there are still too many poses, drop the most redundant, oldest ones.
+  while (poses_.size() > maxPoses_) {
+    auto best = poses_.begin();
+    size_t redundancy = Redundancy(*best);
+    for (auto it = std::next(poses_.begin()); it != window; ++it) {
+      const auto r = Redundancy(*it);
+      if (r > redundancy) {
+        best = it;
+        redundancy = r;
+      }
     }
-    std::cout << processed << "/" << poses_.size() << std::endl;
-    processed = BundleAdjust();
+    remove(best);
+  }
+}
+
+size_t ArUcoTracker::Redundancy(const Pose &pose) const {
+  size_t redundancy = std::numeric_limits<size_t>::max();
+  for (const auto &obs : pose.observed) {
+    redundancy = std::min(redundancy, observers_[obs.first] - 1);
+  }
+  return redundancy;
+}
+
+int64_t ArUcoTracker::Cell(const Eigen::Vector3d &t) {
+  const auto x = static_cast<int64_t>(std::floor(t.x() / kMinDistance));
+  const auto y = static_cast<int64_t>(std::floor(t.y() / kMinDistance));
+  const auto z = static_cast<int64_t>(std::floor(t.z() / kMinDistance));
+  return ((x & 0x1FFFFF) << 42) | ((y & 0x1FFFFF) << 21) | (z & 0x1FFFFF);
+}
+
+void ArUcoTracker::UpdateMarkers(const std::function<void(MarkerMap&)> &update) {
+  auto current = std::atomic_load(&markers_);
+  std::shared_ptr<const MarkerMap> next;
+  do {
+    auto copy = std::make_shared<MarkerMap>(*current);
+    update(*copy);
+    next = copy;
+  } while (!std::atomic_compare_exchange_weak(&markers_, &current, next));
+}
+
+void ArUcoTracker::LoadMap() {
+  std::ifstream is(mapPath_, std::ios::binary);
+  if (!is) {
+    return;
+  }
+
+  MapHeader header;
+  if (!is.read(reinterpret_cast<char*>(&header), sizeof(MapHeader))) {
+    return;
+  }
+  if (header.magic != kMapMagic || header.version != kMapVersion) {
+    return;
+  }
+  if (header.reference < 0 || header.reference >= static_cast<int32_t>(kNumMarkers)) {
+    return;
+  }
+  if (header.count > kNumMarkers) {
+    return;
+  }
+
+  std::vector<MarkerRecord> records(header.count);
+  if (!is.read(reinterpret_cast<char*>(records.data()), sizeof(MarkerRecord) * records.size())) {
+    return;
+  }
+
+  // Restore the markers. Poorly constrained ones or ones without an estimated
+  // covariance must be discovered again, however the reference always defines
+  // the coordinate system. Restored markers are refined with a prior on their
+  // position, which requires a positive definite covariance.
+  auto markers = std::make_shared<MarkerMap>();
+  for (const auto &r : records) {
+    if (r.id < 0 || r.id >= static_cast<int32_t>(kNumMarkers)) {
+      return;
+    }
+    Eigen::Matrix<double, 3, 3> covariance;
+    covariance <<
+        r.covariance[0], r.covariance[1], r.covariance[2],
+        r.covariance[1], r.covariance[3], r.covariance[4],
+        r.covariance[2], r.covariance[4], r.covariance[5];
+    const double variance = covariance.trace();
+    const bool valid = std::isfinite(variance) && variance <= kMaxVariance &&
+        covariance.llt().info() == Eigen::Success;
+    if (r.id != header.reference && !valid) {
+      continue;
+    }
+
+    auto &marker = (*markers)[r.id];
+    marker.t = { r.t[0], r.t[1], r.t[2] };
+    marker.q = Eigen::Quaterniond(r.q[3], r.q[0], r.q[1], r.q[2]).normalized();
+    marker.covariance = covariance;
+    marker.found = true;
+    marker.loaded = r.id != header.reference;
+    marker.prior = marker.t;
+    marker.priorCovariance = covariance;
+  }
+  if (!(*markers)[header.reference].found) {
+    return;
+  }
+
+  reference_ = header.reference;
+  std::atomic_store(&markers_, std::shared_ptr<const MarkerMap>(markers));
+}
+
+void ArUcoTracker::SaveMap(const MarkerMap &markers) const {
+  std::vector<MarkerRecord> records;
+  for (size_t i = 0; i < kNumMarkers; ++i) {
+    const auto &m = markers[i];
+    if (!m.found) {
+      continue;
+    }
+    const auto &c = m.covariance;
+    records.push_back({
+        static_cast<int32_t>(i),
+        {
+          static_cast<float>(m.t.x()),
+          static_cast<float>(m.t.y()),
+          static_cast<float>(m.t.z())
+        },
+        {
+          static_cast<float>(m.q.x()),
+          static_cast<float>(m.q.y()),
+          static_cast<float>(m.q.z()),
+          static_cast<float>(m.q.w())
+        },
+        {
+          static_cast<float>(c(0, 0)),
+          static_cast<float>(c(0, 1)),
+          static_cast<float>(c(0, 2)),
+          static_cast<float>(c(1, 1)),
+          static_cast<float>(c(1, 2)),
+          static_cast<float>(c(2, 2))
+        }
+    });
+  }
+
+  const MapHeader header = {
+    kMapMagic,
+    kMapVersion,
+    static_cast<int32_t>(reference_.load()),
+    static_cast<uint32_t>(records.size())
+  };
+
+  // The map is written to a temporary file which then replaces the old one,
+  // so it survives if the app is killed while writing. Failing to write the
+  // map is not fatal, markers are discovered again.
+  const std::string temp = mapPath_ + ".tmp";
+  {
+    std::ofstream os(temp, std::ios::binary | std::ios::trunc);
+    os.write(reinterpret_cast<const char*>(&header), sizeof(MapHeader));
+    os.write(reinterpret_cast<const char*>(records.data()), sizeof(MarkerRecord) * records.size());
+    os.flush();
+    if (!os) {
+      std::remove(temp.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp.c_str(), mapPath_.c_str()) != 0) {
+    std::remove(temp.c_str());
   }
 }
 
 std::vector<std::vector<cv::Point2f>> ArUcoTracker::GetMarkers() const {
-  return markersCorners_;
+  std::lock_guard<std::mutex> lock(trackingMutex_);
+  return solvedCorners_;
 }
 
 }
\ No newline at end of file
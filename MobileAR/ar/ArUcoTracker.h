@@ -7,8 +7,11 @@
 #include <array>
 #include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <limits>
 #include <list>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -18,6 +21,8 @@
 
 #include <Eigen/Eigen>
 
+#include "ar/MarkerDetector.h"
+#include "ar/OpticalFlow.h"
 #include "ar/Tracker.h"
 
 namespace ar {
@@ -27,6 +32,11 @@ namespace ar {
  */
 constexpr size_t kNumMarkers = 200;
 
+/**
+ Default maximal number of keyframes kept for bundle adjustment.
+ */
+constexpr size_t kMaxPoses = 100;
+
 
 /**
  ArUco Marker Tracking.
@@ -35,21 +45,105 @@ class ArUcoTracker : public Tracker {
  public:
   /**
    Creates an ArUco tracker.
+   
+   @param map Path to the file storing the marker map. If the file exists,
+              the map is loaded and tracking resumes in the same coordinate
+              system. The map is saved after each bundle adjustment run.
    */
-  ArUcoTracker(const cv::Mat k, const cv::Mat d);
+  ArUcoTracker(
+      const cv::Mat k,
+      const cv::Mat d,
+      const std::string &map = "",
+      size_t maxPoses = kMaxPoses);
 
   /**
    Detroys the ArUco tracker.
    */
   virtual ~ArUcoTracker();
 
+  /**
+   Returns the number of times the ArUco detector was run. Frames in between
+   only track corners with optical flow and refine the previous pose.
+   */
+  size_t GetDetections() const { return detections_; }
+
  protected:
   /**
-   Tracker-specific implementation of frame processing.
+   Detects markers and finds their corners.
    */
-  TrackingResult TrackFrameImpl(const cv::Mat &frame, float dt);
+  void Detect(const cv::Mat &frame, double time, Observation &observation);
+
+  /**
+   Finds the camera pose from the detected markers, discovering new ones.
+   */
+  TrackingResult Solve(const Observation &observation, float dt);
 
  private:
+  /**
+   Detects markers, searching only around predicted marker regions if the
+   markers were tracked in the previous frames.
+
+   @return True if the corners were tracked instead of being detected.
+   */
+  bool DetectMarkers(const cv::Mat &frame, double time, std::vector<int> &ids);
+
+  /**
+   Tracks the corners of the markers from the previous frame with pyramidal
+   Lucas-Kanade optical flow.
+   
+   @return False if markers need to be detected again.
+   */
+  bool TrackCorners(const cv::Size &size, std::vector<int> &ids);
+
+  /**
+   Region of the frame expected to contain markers.
+   */
+  struct Region {
+    /// Bounds of the region.
+    cv::Rect rect;
+    /// Downscaling factor suitable for the smallest marker in the region.
+    float scale;
+  };
+
+  /**
+   Predicts the regions markers are expected in, padded to allow for motion.
+   Leaves the regions empty if the full frame should be searched.
+   */
+  void PredictRegions(const cv::Size &size, double time, std::vector<Region> &regions);
+
+  /**
+   Projects a point to the image with the distortion model of OpenCV.
+
+   @return False if the point is behind the camera.
+   */
+  bool Project(
+      const Eigen::Quaternion<double> &q,
+      const Eigen::Matrix<double, 3, 1> &t,
+      const Eigen::Matrix<double, 3, 1> &w,
+      Eigen::Matrix<double, 2, 1> &p) const;
+
+  /**
+   Refines a pose from 2D-3D correspondences with Levenberg-Marquardt, without
+   allocating. Only suitable if the initial pose is close to the solution.
+
+   @return Root mean square reprojection error, infinite if points are
+           behind the camera.
+   */
+  double RefinePose(
+      const std::vector<cv::Point3f> &world,
+      const std::vector<cv::Point2f> &image,
+      Eigen::Quaternion<double> &q,
+      Eigen::Matrix<double, 3, 1> &t) const;
+
+  /**
+   Returns the sum of squared reprojection errors of a pose.
+   */
+  double ReprojectionError(
+      const std::vector<cv::Point3f> &world,
+      const std::vector<cv::Point2f> &image,
+      const Eigen::Quaternion<double> &q,
+      const Eigen::Matrix<double, 3, 1> &t) const;
+
   /**
    solvePnP wrapper because OpenCV is funny.
    */
@@ -65,9 +159,14 @@ class ArUcoTracker : public Tracker {
   /**
    Performs bundle adjustment of multiple marker positions from different poses.
    
+   Only a window of the most recent poses and the markers they observe are
+   optimized, with older poses observing the same markers kept fixed.
+   
+   @param estimate True if the uncertainty of the markers is estimated.
+   
    @return Number of processed poses.
    */
-  size_t BundleAdjust();
+  size_t BundleAdjust(bool estimate);
 
   /**
    Returns the tracked markers.
@@ -82,6 +181,8 @@ class ArUcoTracker : public Tracker {
   cv::Ptr<cv::aruco::Dictionary> dict_;
   /// ArUco detector config.
   cv::Ptr<cv::aruco::DetectorParameters> params_;
+  /// Coarse-to-fine marker detector.
+  MarkerDetector detector_;
 
   /// Marker being tracked.
   struct Marker {
@@ -91,23 +192,36 @@ class ArUcoTracker : public Tracker {
     Eigen::Quaternion<double> q;
 
 
+    /// Covariance of the position, infinite if not estimated.
+    Eigen::Matrix<double, 3, 3> covariance;
     /// True if the marker was found.
     bool found;
-    /// Measured poses from which the final position will be inferred.
-    std::vector<Eigen::Quaterniond> mq;
-    std::vector<Eigen::Vector3d> mt;
+    /// True if the marker was restored from the map.
+    bool loaded;
+    /// Position restored from the map, refined with a prior.
+    Eigen::Matrix<double, 3, 1> prior;
+    /// Covariance of the restored position.
+    Eigen::Matrix<double, 3, 3> priorCovariance;
 
     /// Image points of the corners.
-    std::vector<Eigen::Matrix<double, 3, 1>> world() const;
+    std::array<Eigen::Matrix<double, 3, 1>, 4> world() const;
 
     Marker()
       : t(0, 0, 0)
       , q(1, 0, 0, 0)
+      , covariance(Eigen::Matrix<double, 3, 3>::Constant(
+            std::numeric_limits<double>::infinity()))
       , found(false)
+      , loaded(false)
+      , prior(0, 0, 0)
+      , priorCovariance(Eigen::Matrix<double, 3, 3>::Identity())
     {
     }
   };
 
+  /// Positions of all markers.
+  typedef std::array<Marker, kNumMarkers> MarkerMap;
+
   /// Pose with marker measurements.
   struct Pose {
     /// Position of the camera.
@@ -136,18 +250,80 @@ class ArUcoTracker : public Tracker {
     }
   };
   
-  /// ID of the first marker, the reference point.
-  MarkerID reference_;
+  /**
+   Checks if a pose close to the given one was already recorded.
+   */
+  bool HasNearbyPose(const Eigen::Quaterniond &q, const Eigen::Vector3d &t) const;
+
+  /**
+   Records a new pose, indexing it.
+   */
+  void AddPose(
+      const Eigen::Quaterniond &q,
+      const Eigen::Vector3d &t,
+      const std::vector<int> &ids,
+      const std::vector<std::vector<cv::Point2f>> &corners);
+
+  /**
+   Removes redundant poses outside the bundle adjustment window, then the
+   most redundant ones until at most maxPoses_ are left.
+   */
+  void CullPoses();
+
+  /**
+   Returns the smallest number of other poses observing a marker of a pose.
+   */
+  size_t Redundancy(const Pose &pose) const;
+
+  /**
+   Returns the key of the spatial index cell a position falls into.
+   */
+  static int64_t Cell(const Eigen::Vector3d &t);
+
+  /**
+   Publishes a new version of the marker map, applying an update to a copy
+   of the latest one. The update might be applied multiple times if another
+   thread publishes a version concurrently.
+   */
+  void UpdateMarkers(const std::function<void(MarkerMap&)> &update);
+
+  /**
+   Loads the marker map, if it was saved before.
+   */
+  void LoadMap();
+
+  /**
+   Saves the marker map.
+   */
+  void SaveMap(const MarkerMap &markers) const;
+
+  /// Path to the marker map file.
+  const std::string mapPath_;
+
+  /// ID of the first marker, the reference point. Set by the solver thread,
+  /// read by the bundle adjustment thread.
+  std::atomic<MarkerID> reference_;
 
   /// List of poses to be optimized for.
   std::list<Pose> poses_;
+  /// Spatial index of poses, hashing cells as large as the minimal distance.
+  std::unordered_map<int64_t, std::vector<std::list<Pose>::iterator>> grid_;
+  /// Number of poses observing each of the markers.
+  std::array<size_t, kNumMarkers> observers_;
+  /// Total number of poses recorded.
+  size_t posesAdded_;
+  /// Maximal number of poses kept.
+  size_t maxPoses_;
   /// Guard protecting poses.
   std::mutex poseMutex_;
 
-  /// List of all markers.
-  std::array<Marker, kNumMarkers> markers_;
-  /// Guard protecting markers.
-  std::mutex markerMutex_;
+  /// Latest version of the marker map. Versions are immutable, so readers
+  /// use a snapshot without locking, while writers replace it atomically.
+  std::shared_ptr<const MarkerMap> markers_;
+  /// Measured poses of undiscovered markers, from which their final position
+  /// will be inferred. Only used by the tracking thread.
+  std::array<std::vector<Eigen::Quaterniond>, kNumMarkers> measuredQ_;
+  std::array<std::vector<Eigen::Vector3d>, kNumMarkers> measuredT_;
 
   /// Bundle adjustment thread.
   std::thread thread_;
@@ -158,6 +334,47 @@ class ArUcoTracker : public Tracker {
 
   /// Currently tracked markers.
   std::vector<std::vector<cv::Point2f>> markersCorners_;
+  /// IDs of the currently tracked markers.
+  std::vector<int> markerIDs_;
+  /// Corner tracker, holding the pyramids of the two most recent frames.
+  OpticalFlow flow_;
+  /// Number of times the ArUco detector was run.
+  std::atomic<size_t> detections_;
+  /// Distortion coefficients k1, k2, p1, p2, k3.
+  std::array<double, 5> dist_;
+
+  /// Scratch buffers reused across frames to avoid allocations.
+  std::vector<int> inliers_;
+  std::vector<int> markerID_;
+  std::vector<int> inlierCorners_;
+  std::vector<cv::Point3f> world_;
+  std::vector<cv::Point2f> image_;
+  cv::Mat rvec_;
+  cv::Mat tvec_;
+  std::vector<cv::Point2f> flowPrev_;
+  std::vector<cv::Point2f> flowNext_;
+  std::vector<uint8_t> flowStatus_;
+  std::vector<float> flowError_;
+  std::vector<std::vector<cv::Point2f>> trackedCorners_;
+  std::vector<Region> regions_;
+  std::vector<std::vector<cv::Point2f>> detectedCorners_;
+  std::vector<std::vector<cv::Point2f>> regionCorners_;
+  std::vector<int> regionIDs_;
+
+  /// Pose found in the previous frame, used as an initial guess if corners
+  /// are tracked. Only used by the pose solver.
+  Eigen::Quaternion<double> prevQ_;
+  Eigen::Matrix<double, 3, 1> prevT_;
+  bool hasPrevPose_;
+
+  /// Number of frames since the last full frame search.
+  size_t framesSinceSearch_;
+  /// Number of frames since markers were last detected.
+  size_t framesSinceDetection_;
+  /// Guard for the state shared by detection and the pose solver.
+  mutable std::mutex trackingMutex_;
+  /// Corners of the markers processed by the pose solver.
+  std::vector<std::vector<cv::Point2f>> solvedCorners_;
 };
 
 }
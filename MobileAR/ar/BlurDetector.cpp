@@ -2,48 +2,94 @@
 // Licensing information can be found in the LICENSE file.
 // (C) 2015 Nandor Licker. All rights reserved.
 
+#include <Eigen/Eigen>
+
 #include "ar/BlurDetector.h"
+#include "ar/Parallel.h"
 
 
 namespace ar {
 
-BlurDetector::BlurDetector(int rows, int cols, int threshold)
-  : rows_((rows >> 4) << 4)
-  , cols_((cols >> 4) << 4)
-  , threshold_(threshold)
-  , levels({
-    std::make_shared<Level>(rows_ >> 1, cols_ >> 1, 8),
-    std::make_shared<Level>(rows_ >> 2, cols_ >> 2, 4),
-    std::make_shared<Level>(rows_ >> 3, cols_ >> 3, 2)
-  })
+namespace {
+
+/// Number of image sizes levels are kept for.
+constexpr size_t kMaxSizes = 4;
+
+/**
+ Computes a row of the low pass image and of the edge map from two rows.
+ 
+ The rows are summed and subtracted first, so the horizontal step only
+ combines even and odd columns:
+ 
+   LL = (a0 + a1) / 2, HL = (a0 - a1) / 2, LH = (d0 + d1) / 2, HH = (d0 - d1) / 2
+ */
+template<typename T>
+void HaarRow(
+    const T *p0,
+    const T *p1,
+    int cols,
+    Eigen::ArrayXf &a,
+    Eigen::ArrayXf &d,
+    float *LL,
+    Eigen::ArrayXf &EMap)
+{
+  typedef Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>> Row;
+  typedef Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<2>> Strided;
+
+  const Row r0(p0, cols << 1), r1(p1, cols << 1);
+  a = r0.template cast<float>() + r1.template cast<float>();
+  d = r0.template cast<float>() - r1.template cast<float>();
+
+  const Strided a0(a.data() + 0, cols), a1(a.data() + 1, cols);
+  const Strided d0(d.data() + 0, cols), d1(d.data() + 1, cols);
+  Eigen::Map<Eigen::ArrayXf>(LL, cols) = (a0 + a1) * 0.5f;
+  EMap = ((a0 - a1).square() + (d0 + d1).square() + (d0 - d1).square()) * 0.25f;
+}
+
+}
+
+BlurDetector::BlurDetector(int threshold, const cv::Rect &roi)
+  : threshold_(static_cast<float>(threshold))
+  , roi_(roi)
 {
 }
 
 
 std::pair<float, float> BlurDetector::operator() (const cv::Mat &gray) {
-  // Crop the image to a size that is multiple of 16.
-  cv::Mat LL;
-  gray({0, 0, cols_, rows_}).convertTo(LL, CV_32F);
+  // Select the region of interest.
+  const cv::Mat image = roi_.area() > 0 ? gray(roi_ & cv::Rect(0, 0, gray.cols, gray.rows)) : gray;
   
-  cv::Mat temp;
-  cv::cvtColor(LL, temp, CV_GRAY2BGR);
+  // Crop the image to a size that is multiple of 16. The first level reads
+  // 8 bit images directly, without converting them to floats first.
+  const int rows = (image.rows >> 4) << 4;
+  const int cols = (image.cols >> 4) << 4;
+  if (rows == 0 || cols == 0) {
+    return { 0.0f, 0.0f };
+  }
+  const cv::Mat LL = image({0, 0, cols, rows});
+  auto &levels = Levels(rows, cols);
   
   // Build the 3 levels of the pyramid.
-  BuildLevel<1, 3>(           LL, levels[0]);
-  BuildLevel<2, 2>(levels[0]->LL, levels[1]);
-  BuildLevel<3, 1>(levels[1]->LL, levels[2]);
+  if (LL.depth() == CV_8U) {
+    BuildLevel<1, 3, uint8_t>(LL, rows, cols, *levels[0]);
+  } else {
+    LL.convertTo(float_, CV_32F);
+    BuildLevel<1, 3, float>(float_, rows, cols, *levels[0]);
+  }
+  BuildLevel<2, 2, float>(levels[0]->LL, rows, cols, *levels[1]);
+  BuildLevel<3, 1, float>(levels[1]->LL, rows, cols, *levels[2]);
   
   // Count the number of different edge types.
   int Nedge = 0;
   int Nda = 0;
   int Nrg = 0;
   int Nbrg = 0;
-  for (int r = 0; r < (rows_ >> 4); ++r) {
+  for (int r = 0; r < (rows >> 4); ++r) {
     const auto pE1 = levels[0]->EMax.ptr<float>(r);
     const auto pE2 = levels[1]->EMax.ptr<float>(r);
     const auto pE3 = levels[2]->EMax.ptr<float>(r);
     
-    for (int c = 0; c < (cols_ >> 4); ++c) {
+    for (int c = 0; c < (cols >> 4); ++c) {
       const auto E1 = pE1[c], E2 = pE2[c], E3 = pE3[c];
       
       // Rule 1: Bail out if not an edge.
@@ -79,61 +125,62 @@ std::pair<float, float> BlurDetector::operator() (const cv::Mat &gray) {
   return { per, blur };
 }
 
-template<size_t N>
-void BlurDetector::HaarTransform(
-     const cv::Mat &LL0,
-     cv::Mat &HH1,
-     cv::Mat &LH1,
-     cv::Mat &HL1,
-     cv::Mat &LL1)
-{
-  for (int r = 0; r < rows_ >> N; ++r) {
-    for (int c = 0; c < cols_ >> N; ++c) {
-      const float p00 = LL0.at<float>((r << 1) + 0, (c << 1) + 0);
-      const float p01 = LL0.at<float>((r << 1) + 0, (c << 1) + 1);
-      const float p10 = LL0.at<float>((r << 1) + 1, (c << 1) + 0);
-      const float p11 = LL0.at<float>((r << 1) + 1, (c << 1) + 1);
-      
-      HH1.at<float>(r, c) = (p00 + p11 - p10 - p01) * 0.5f;
-      HL1.at<float>(r, c) = (p00 + p10 - p11 - p01) * 0.5f;
-      LH1.at<float>(r, c) = (p00 + p01 - p10 - p11) * 0.5f;
-      LL1.at<float>(r, c) = (p00 + p01 + p10 + p11) * 0.5f;
+std::array<std::shared_ptr<BlurDetector::Level>, 3> &BlurDetector::Levels(int rows, int cols) {
+  // Move the levels of a known size to the front, without reallocating.
+  const cv::Size size(cols, rows);
+  for (auto it = levels_.begin(); it != levels_.end(); ++it) {
+    if (it->first == size) {
+      levels_.splice(levels_.begin(), levels_, it);
+      return levels_.front().second;
     }
   }
-}
-
-template<size_t N, size_t M>
-void BlurDetector::LocalMaxima(const cv::Mat &EMap, cv::Mat &EMax) {
-  for (int r0 = 0; r0 < rows_ >> (N + M); ++r0) {
-    for (int c0 = 0; c0 < cols_ >> (N + M); ++c0) {
-      float max = std::numeric_limits<float>::min();
-      for (int dr = 0; dr < (1 << M); ++dr) {
-        for (int dc = 0; dc < (1 << M); ++dc) {
-          max = std::max(max, EMap.at<float>((r0 << M) + dr, (c0 << M) + dc));
-        }
-      }
-      EMax.at<float>(r0, c0) = max;
-    }
+  
+  levels_.emplace_front(size, std::array<std::shared_ptr<Level>, 3>{{
+      std::make_shared<Level>(rows >> 1, cols >> 1, 8),
+      std::make_shared<Level>(rows >> 2, cols >> 2, 4),
+      std::make_shared<Level>(rows >> 3, cols >> 3, 2)
+  }});
+  if (levels_.size() > kMaxSizes) {
+    levels_.pop_back();
   }
+  return levels_.front().second;
 }
 
-template<size_t N, size_t M>
-void BlurDetector::BuildLevel(const cv::Mat &LL0, const std::shared_ptr<Level> &l) {
-  HaarTransform<N>(LL0, l->HH, l->LH, l->HL, l->LL);
+
+template<size_t N, size_t M, typename T>
+void BlurDetector::BuildLevel(const cv::Mat &LL0, int rows, int cols, Level &l) {
+  const int width = cols >> N;
   
-  for (int r = 0; r < rows_ >> N; ++r) {
-    auto pEMap = l->EMap.ptr<float>(r);
+  // Each task builds the rows covered by a row of maxima.
+  ParallelFor(0, rows >> (N + M), [&](int r0) {
+    Eigen::ArrayXf a(width << 1), d(width << 1), EMap(width), EMax(width);
     
-    const auto pHH = l->HH.ptr<float>(r);
-    const auto pHL = l->HL.ptr<float>(r);
-    const auto pLH = l->LH.ptr<float>(r);
-    
-    for (int c = 0; c < cols_ >> N; ++c) {
-      pEMap[c] = pHH[c] * pHH[c] + pHL[c] * pHL[c] + pLH[c] * pLH[c];
+    for (int dr = 0; dr < (1 << M); ++dr) {
+      const int r = (r0 << M) + dr;
+      HaarRow(
+          LL0.ptr<T>((r << 1) + 0),
+          LL0.ptr<T>((r << 1) + 1),
+          width,
+          a,
+          d,
+          l.LL.ptr<float>(r),
+          EMap
+      );
+      
+      // Vertical maxima of the block.
+      if (dr == 0) {
+        EMax = EMap;
+      } else {
+        EMax = EMax.max(EMap);
+      }
     }
-  }
-  
-  LocalMaxima<N, M>(l->EMap, l->EMax);
+    
+    // Horizontal maxima: each column of the map holds a window.
+    Eigen::Map<Eigen::RowVectorXf>(l.EMax.ptr<float>(r0), width >> M) =
+        Eigen::Map<const Eigen::Matrix<float, (1 << M), Eigen::Dynamic>>(
+            EMax.data(), 1 << M, width >> M
+        ).colwise().maxCoeff();
+  });
 }
   
-}
\ No newline at end of file
+}
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <array>
+#include <list>
+#include <memory>
 
 #include <opencv2/opencv.hpp>
 
@@ -20,29 +22,18 @@ class BlurDetector {
   
   /**
    Haar Pyramid Level.
+   
+   Detail coefficients and the edge map are not stored: the low pass image
+   feeds the next level and only the maxima are used for scoring.
    */
   struct Level {
     // Low pass/Low pass.
     cv::Mat LL;
-    // High pass/High pass.
-    cv::Mat HH;
-    // Low pass/High pass.
-    cv::Mat LH;
-    // High pass/Low pass.
-    cv::Mat HL;
-    // Edge map.
-    cv::Mat EMap;
     // Local maxima window.
     cv::Mat EMax;
-    // Window size.
-    size_t n;
     
     Level(int rows, int cols, int n)
       : LL(rows, cols, CV_32F)
-      , HH(rows, cols, CV_32F)
-      , LH(rows, cols, CV_32F)
-      , HL(rows, cols, CV_32F)
-      , EMap(rows, cols, CV_32F)
       , EMax(rows / n, cols / n, CV_32F)
     {
     }
@@ -51,48 +42,43 @@ class BlurDetector {
  public:
   /**
    Creates a new detector.
+   
+   @param threshold Edge threshold.
+   @param roi       Region of the image to score, the whole image if empty.
    */
-  BlurDetector(int rows, int cols, int threshold = 35);
+  BlurDetector(int threshold = 35, const cv::Rect &roi = {});
   
   /** 
-   Runs the detector on an image.
+   Runs the detector on an 8 bit or floating point image of any size.
    */
   std::pair<float, float> operator() (const cv::Mat &gray);
   
  private:
   /**
-   2D Haar Wavelet transform.
+   Returns the levels for an image size, allocating them on first use and
+   evicting the levels of the least recently used size if too many are kept.
    */
-  template<size_t N>
-  void HaarTransform(
-      const cv::Mat &LL0,
-      cv::Mat &HH1,
-      cv::Mat &LH1,
-      cv::Mat &HL1,
-      cv::Mat &LL1);
+  std::array<std::shared_ptr<Level>, 3> &Levels(int rows, int cols);
   
   /**
-   Find the downscaled local maxima.
+   Builds a level with a fused pass computing the 2D Haar wavelet transform,
+   the edge map and its local maxima, in parallel over blocks of rows.
    */
-  template<size_t N, size_t M>
-  void LocalMaxima(const cv::Mat &EMap, cv::Mat &EMax);
-  
-  /**
-   * Builds a level.
-   */
-  template<size_t N, size_t M>
-  void BuildLevel(const cv::Mat &LL0, const std::shared_ptr<Level> &l);
+  template<size_t N, size_t M, typename T>
+  void BuildLevel(const cv::Mat &LL0, int rows, int cols, Level &l);
   
  private:
-  // Size of the cropped image.
-  int rows_;
-  int cols_;
-  
   // Edge threshold.
-  int threshold_;
+  float threshold_;
+  
+  // Region of interest.
+  cv::Rect roi_;
+  
+  // Floating point copy of the input, if not 8 bit.
+  cv::Mat float_;
   
-  // All Haar levels.
-  std::array<std::shared_ptr<Level>, 3> levels;
+  // Haar levels of the cropped image sizes, most recently used first.
+  std::list<std::pair<cv::Size, std::array<std::shared_ptr<Level>, 3>>> levels_;
 };
   
 }
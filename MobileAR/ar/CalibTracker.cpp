@@ -27,25 +27,33 @@ CalibTracker::CalibTracker(const cv::Mat k, const cv::Mat d)
 }
 
 CalibTracker::~CalibTracker() {
+  StopPipeline();
 }
 
-Tracker::TrackingResult CalibTracker::TrackFrameImpl(const cv::Mat &frame, float dt) {
+void CalibTracker::Detect(const cv::Mat &frame, double time, Observation &observation) {
+  observation.ids.clear();
+  observation.corners.resize(1);
 
   // Detect the pattern.
-  std::vector<cv::Point2f> corners;
   auto found = cv::findCirclesGrid(
       frame,
       kPatternSize,
-      corners,
+      observation.corners[0],
       cv::CALIB_CB_ASYMMETRIC_GRID | cv::CALIB_CB_CLUSTERING
   );
-  if (!found) {
+  if (found) {
+    observation.ids.push_back(0);
+  }
+}
+
+Tracker::TrackingResult CalibTracker::Solve(const Observation &observation, float dt) {
+  if (observation.ids.empty()) {
     return { false, {}, {} };
   }
 
   // If pattern found, use solvePnP to compute pose.
   cv::Mat rvec, tvec;
-  cv::solvePnP({ grid_ }, corners, k, d, rvec, tvec, false, CV_EPNP);
+  cv::solvePnP({ grid_ }, observation.corners[0], k, d, rvec, tvec, false, CV_EPNP);
 
   // Pass to Eigen.
   Eigen::Matrix<float, 3, 1> r;
@@ -31,9 +31,14 @@ class CalibTracker : public Tracker {
 
  protected:
   /**
-   Tracker-specific implementation of frame processing.
+   Detects the calibration pattern.
    */
-  TrackingResult TrackFrameImpl(const cv::Mat &frame, float dt);
+  void Detect(const cv::Mat &frame, double time, Observation &observation);
+
+  /**
+   Finds the pose of the camera relative to the pattern.
+   */
+  TrackingResult Solve(const Observation &observation, float dt);
 
  private:
   // Reference grid.
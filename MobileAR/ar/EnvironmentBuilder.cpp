@@ -203,7 +203,7 @@ EnvironmentBuilder::EnvironmentBuilder(
   , checkBlur_(checkBlur)
   , baMethod_(baMethod)
   , hMethod_(hMethod)
-  , blurDetector_(checkBlur_ ? new BlurDetector(720, 1280) : nullptr)
+  , blurDetector_(checkBlur_ ? new BlurDetector() : nullptr)
   , orbDetector_(cv::ORB::create(1000))
   , bfMatcher_(cv::NORM_HAMMING, true)
 {
@@ -0,0 +1,377 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <Eigen/Eigen>
+
+#include "ar/EnvironmentPrefilter.h"
+#include "ar/Parallel.h"
+#include "ar/SHProjector.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Size of the tiles faces are split into.
+constexpr int kTileSize = 16;
+/// Smallest width of the source pyramid.
+constexpr int kMinPyramidWidth = 8;
+
+
+/**
+ Converts cube face coordinates in [-1, 1] to an environment direction.
+ */
+Eigen::Vector3f FaceToDirection(int face, float s, float t) {
+  Eigen::Vector3f c;
+  switch (face) {
+    case 0: c = { +1.0f,    -t,    -s }; break;
+    case 1: c = { -1.0f,    -t,    +s }; break;
+    case 2: c = {    +s, +1.0f,    +t }; break;
+    case 3: c = {    +s, -1.0f,    -t }; break;
+    case 4: c = {    +s,    -t, +1.0f }; break;
+    case 5: c = {    -s,    -t, -1.0f }; break;
+  }
+  return Eigen::Vector3f(c.x(), -c.z(), c.y()).normalized();
+}
+
+
+/**
+ Converts an environment direction to cube face coordinates in [-1, 1].
+ */
+int DirectionToFace(const Eigen::Vector3f &d, float &s, float &t) {
+  const float x = d.x(), y = d.z(), z = -d.y();
+  const float ax = std::abs(x), ay = std::abs(y), az = std::abs(z);
+  if (ax >= ay && ax >= az) {
+    s = (x > 0 ? -z : z) / ax;
+    t = -y / ax;
+    return x > 0 ? 0 : 1;
+  }
+  if (ay >= az) {
+    s = x / ay;
+    t = (y > 0 ? z : -z) / ay;
+    return y > 0 ? 2 : 3;
+  }
+  s = (z > 0 ? x : -x) / az;
+  t = -y / az;
+  return z > 0 ? 4 : 5;
+}
+
+
+/**
+ Bilinear lookup in a floating point RGB image, wrapping horizontally.
+ */
+cv::Vec3f Bilinear(const cv::Mat &img, float u, float v) {
+  const float x = u * img.cols - 0.5f;
+  const float y = std::min(std::max(v * img.rows - 0.5f, 0.0f), img.rows - 1.0f);
+
+  const int x0 = static_cast<int>(std::floor(x));
+  const int y0 = static_cast<int>(y);
+  const float fx = x - x0;
+  const float fy = y - y0;
+
+  const int c0 = (x0 % img.cols + img.cols) % img.cols;
+  const int c1 = (c0 + 1) % img.cols;
+  const int r1 = std::min(y0 + 1, img.rows - 1);
+
+  const auto p0 = img.ptr<cv::Vec3f>(y0);
+  const auto p1 = img.ptr<cv::Vec3f>(r1);
+  return
+      (p0[c0] * (1.0f - fx) + p0[c1] * fx) * (1.0f - fy) +
+      (p1[c0] * (1.0f - fx) + p1[c1] * fx) * fy;
+}
+
+
+/**
+ Converts any supported image to a floating point RGB image.
+ */
+cv::Mat ToFloatRGB(const cv::Mat &image) {
+  cv::Mat rgb;
+  switch (image.type()) {
+    case CV_32FC3: rgb = image; break;
+    case CV_32FC4: cv::cvtColor(image, rgb, CV_BGRA2BGR); break;
+    case CV_8UC3: image.convertTo(rgb, CV_32FC3, 1.0f / 255.0f); break;
+    case CV_8UC4: {
+      cv::Mat rgb8;
+      cv::cvtColor(image, rgb8, CV_BGRA2BGR);
+      rgb8.convertTo(rgb, CV_32FC3, 1.0f / 255.0f);
+      break;
+    }
+    default: {
+      throw std::runtime_error("Unsupported environment map format.");
+    }
+  }
+  return rgb;
+}
+
+
+/**
+ Resamples a vertically stacked cube map to an equirectangular image.
+ */
+cv::Mat CubeToEquirect(const cv::Mat &faces) {
+  const int n = faces.cols;
+  cv::Mat equirect(2 * n, 4 * n, CV_32FC3);
+
+  ParallelFor(0, equirect.rows, [&](int r) {
+    const double phi = M_PI / 2.0 - M_PI * (r + 0.5) / equirect.rows;
+    auto row = equirect.ptr<cv::Vec3f>(r);
+    for (int c = 0; c < equirect.cols; ++c) {
+      const double theta = 2.0 * M_PI * (c + 0.5) / equirect.cols;
+      const Eigen::Vector3f d(
+          std::cos(phi) * std::cos(theta),
+          std::cos(phi) * std::sin(theta),
+          std::sin(phi)
+      );
+
+      float s, t;
+      const int face = DirectionToFace(d, s, t);
+      const int fx = std::min(n - 1, static_cast<int>((s + 1.0f) * 0.5f * n));
+      const int fy = std::min(n - 1, static_cast<int>((t + 1.0f) * 0.5f * n));
+      row[c] = faces.at<cv::Vec3f>(face * n + fy, fx);
+    }
+  });
+  return equirect;
+}
+
+
+/**
+ Pyramid of equirectangular images, sampled by direction and level of detail.
+ */
+class EquirectPyramid {
+ public:
+  EquirectPyramid(const cv::Mat &image) {
+    levels_.push_back(image);
+    while (levels_.back().cols > kMinPyramidWidth) {
+      const cv::Mat &prev = levels_.back();
+      cv::Mat next;
+      cv::resize(prev, next, { prev.cols / 2, std::max(1, prev.rows / 2) }, 0, 0, cv::INTER_AREA);
+      levels_.push_back(next);
+    }
+  }
+
+  /**
+   Average solid angle of a texel at the finest level.
+   */
+  float texelSolidAngle() const {
+    return static_cast<float>(4.0 * M_PI / levels_[0].total());
+  }
+
+  /**
+   Trilinear lookup in a direction.
+   */
+  cv::Vec3f fetch(float x, float y, float z, float lod) const {
+    const float u = static_cast<float>(std::atan2(y, x) / (2.0 * M_PI));
+    const float v = static_cast<float>(std::acos(std::min(std::max(z, -1.0f), 1.0f)) / M_PI);
+    const float uw = u < 0.0f ? u + 1.0f : u;
+
+    lod = std::min(std::max(lod, 0.0f), static_cast<float>(levels_.size() - 1));
+    const int l0 = static_cast<int>(lod);
+    const int l1 = std::min(l0 + 1, static_cast<int>(levels_.size() - 1));
+    const float f = lod - l0;
+    if (f < 1e-3f || l0 == l1) {
+      return Bilinear(levels_[l0], uw, v);
+    }
+    return Bilinear(levels_[l0], uw, v) * (1.0f - f) + Bilinear(levels_[l1], uw, v) * f;
+  }
+
+ private:
+  /// Levels, halving in size.
+  std::vector<cv::Mat> levels_;
+};
+
+
+/**
+ Samples of the GGX lobe around +Z, shared by all texels of a level.
+ */
+struct GGXSamples {
+  /// Sample directions, one per column.
+  Eigen::Matrix<float, 3, Eigen::Dynamic> l;
+  /// Cosine weights.
+  Eigen::VectorXf w;
+  /// Pyramid level to read from.
+  Eigen::VectorXf lod;
+  /// Sum of all weights.
+  float sum;
+
+  GGXSamples(float roughness, int count, float texelSolidAngle) {
+    const float a = roughness * roughness;
+    const float a2 = a * a;
+
+    std::vector<Eigen::Vector3f> ls;
+    std::vector<float> ws, lods;
+    for (int i = 0; i < count; ++i) {
+      // Hammersley point set.
+      uint32_t bits = static_cast<uint32_t>(i);
+      bits = (bits << 16u) | (bits >> 16u);
+      bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+      bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+      bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+      bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+      const float u0 = static_cast<float>(i) / count;
+      const float u1 = bits * 2.3283064365386963e-10f;
+
+      // Half vector, assuming the view direction is the normal.
+      const float phi = static_cast<float>(2.0 * M_PI * u0);
+      const float cosT = std::sqrt((1.0f - u1) / (1.0f + (a2 - 1.0f) * u1));
+      const float sinT = std::sqrt(1.0f - cosT * cosT);
+      const Eigen::Vector3f h(sinT * std::cos(phi), sinT * std::sin(phi), cosT);
+
+      // Reflect around the half vector.
+      const Eigen::Vector3f l = 2.0f * cosT * h - Eigen::Vector3f::UnitZ();
+      if (l.z() <= 0.0f) {
+        continue;
+      }
+
+      // Read from a coarser level if the sample covers a large solid angle.
+      const float d = a2 / static_cast<float>(
+          M_PI * std::pow(cosT * cosT * (a2 - 1.0f) + 1.0f, 2.0f)
+      );
+      const float pdf = d / 4.0f;
+      const float sampleSolidAngle = 1.0f / (count * pdf + 1e-6f);
+      ls.push_back(l);
+      ws.push_back(l.z());
+      lods.push_back(std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f));
+    }
+
+    l.resize(3, ls.size());
+    w.resize(ls.size());
+    lod.resize(ls.size());
+    for (size_t i = 0; i < ls.size(); ++i) {
+      l.col(i) = ls[i];
+      w(i) = ws[i];
+      lod(i) = lods[i];
+    }
+    sum = w.sum();
+  }
+};
+
+
+/**
+ Creates a cube map with uninitialized RGBA faces.
+ */
+CubeMap CreateCube(int size) {
+  CubeMap cube;
+  for (auto &face : cube) {
+    face.create(size, size, CV_32FC4);
+  }
+  return cube;
+}
+
+
+/**
+ Runs a function over all texels of a cube map, one tile at a time.
+ */
+template<typename F>
+void ForEachTile(CubeMap &cube, const F &f) {
+  const int size = cube[0].rows;
+  const int tiles = (size + kTileSize - 1) / kTileSize;
+  ParallelFor(0, 6 * tiles * tiles, [&](int index) {
+    const int face = index / (tiles * tiles);
+    const int ty = (index / tiles) % tiles;
+    const int tx = index % tiles;
+    f(
+        face,
+        cube[face],
+        ty * kTileSize, std::min(size, (ty + 1) * kTileSize),
+        tx * kTileSize, std::min(size, (tx + 1) * kTileSize)
+    );
+  });
+}
+
+}
+
+
+EnvironmentPrefilter::EnvironmentPrefilter(
+    int size,
+    int levels,
+    int samples,
+    int irradianceSize)
+  : size_(size)
+  , levels_(levels)
+  , samples_(samples)
+  , irradianceSize_(irradianceSize)
+{
+  assert(levels_ > 0 && (size_ >> (levels_ - 1)) > 0);
+}
+
+
+PrefilteredEnvironment EnvironmentPrefilter::operator() (const cv::Mat &image) const {
+
+  // Bring the source to an equirectangular float image and build its pyramid.
+  cv::Mat source = ToFloatRGB(image);
+  if (source.rows == source.cols * 6) {
+    source = CubeToEquirect(source);
+  }
+  const EquirectPyramid pyramid(source);
+
+  PrefilteredEnvironment env;
+
+  // Irradiance from the SH projection, which is exact enough for a cosine lobe.
+  {
+    const auto sh = SHProjector::irradiance(SHProjector(3, 256)(source));
+    env.irradiance = CreateCube(irradianceSize_);
+    ForEachTile(env.irradiance, [&](int face, cv::Mat &dst, int r0, int r1, int c0, int c1) {
+      const int n = dst.rows;
+      for (int r = r0; r < r1; ++r) {
+        auto row = dst.ptr<cv::Vec4f>(r);
+        for (int c = c0; c < c1; ++c) {
+          const auto d = FaceToDirection(face, 2.0f * (c + 0.5f) / n - 1.0f, 2.0f * (r + 0.5f) / n - 1.0f);
+          const auto e = SHProjector::evaluate(sh, d.x(), d.y(), d.z()) / static_cast<float>(M_PI);
+          row[c] = cv::Vec4f(e[0], e[1], e[2], 1.0f);
+        }
+      }
+    });
+  }
+
+  // Specular levels, with roughness increasing linearly.
+  for (int level = 0; level < levels_; ++level) {
+    const int size = size_ >> level;
+    const float roughness = levels_ > 1 ? static_cast<float>(level) / (levels_ - 1) : 0.0f;
+    const GGXSamples samples(roughness, level == 0 ? 1 : samples_, pyramid.texelSolidAngle());
+
+    CubeMap cube = CreateCube(size);
+    ForEachTile(cube, [&](int face, cv::Mat &dst, int r0, int r1, int c0, int c1) {
+      Eigen::Matrix<float, 3, Eigen::Dynamic> l(3, samples.l.cols());
+      for (int r = r0; r < r1; ++r) {
+        auto row = dst.ptr<cv::Vec4f>(r);
+        for (int c = c0; c < c1; ++c) {
+          const float s = 2.0f * (c + 0.5f) / size - 1.0f;
+          const float t = 2.0f * (r + 0.5f) / size - 1.0f;
+          const Eigen::Vector3f n = FaceToDirection(face, s, t);
+
+          // Mirror level: single lookup, matching the footprint of the texel.
+          if (level == 0) {
+            const float texel = 4.0f / (size * size * std::pow(1.0f + s * s + t * t, 1.5f));
+            const float lod = std::max(0.5f * std::log2(texel / pyramid.texelSolidAngle()), 0.0f);
+            const auto v = pyramid.fetch(n.x(), n.y(), n.z(), lod);
+            row[c] = cv::Vec4f(v[0], v[1], v[2], 1.0f);
+            continue;
+          }
+
+          // Rotate all samples into the frame of the normal at once.
+          const Eigen::Vector3f up = std::abs(n.z()) < 0.999f
+              ? Eigen::Vector3f::UnitZ()
+              : Eigen::Vector3f::UnitX();
+          Eigen::Matrix3f frame;
+          frame.col(0) = up.cross(n).normalized();
+          frame.col(1) = n.cross(frame.col(0));
+          frame.col(2) = n;
+          l.noalias() = frame * samples.l;
+
+          // Accumulate the weighted samples.
+          cv::Vec3f sum(0.0f, 0.0f, 0.0f);
+          for (int i = 0; i < l.cols(); ++i) {
+            sum += pyramid.fetch(l(0, i), l(1, i), l(2, i), samples.lod(i)) * samples.w(i);
+          }
+          sum = sum * (1.0f / samples.sum);
+          row[c] = cv::Vec4f(sum[0], sum[1], sum[2], 1.0f);
+        }
+      }
+    });
+    env.specular.push_back(cube);
+  }
+
+  return env;
+}
+
+}
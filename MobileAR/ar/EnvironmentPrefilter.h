@@ -0,0 +1,79 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Cube map, with faces in the +X, -X, +Y, -Y, +Z, -Z order.
+ */
+typedef std::array<cv::Mat, 6> CubeMap;
+
+
+/**
+ Convolved environment maps for image based lighting.
+ 
+ Faces are continuous RGBA floating point images, so they can be uploaded
+ directly into the slices of a cube texture. The cube's +Y axis is mapped to
+ the up (+Z) axis of the environment.
+ */
+struct PrefilteredEnvironment {
+  /// Diffuse irradiance, divided by pi.
+  CubeMap irradiance;
+  /// GGX-filtered radiance, one level per mip with increasing roughness.
+  std::vector<CubeMap> specular;
+};
+
+
+/**
+ Prefilters environment maps on the CPU.
+ 
+ Irradiance is evaluated from a 9 coefficient SH projection. Specular levels
+ use GGX importance sampling, reading from a pyramid of the source in order
+ to avoid noise with few samples. Faces are split into tiles which are
+ processed in parallel.
+ */
+class EnvironmentPrefilter {
+ public:
+  /**
+   Creates a prefilter.
+   
+   @param size      Size of the first specular level.
+   @param levels    Number of specular levels.
+   @param samples   Number of GGX samples per texel.
+   @param irradianceSize Size of the irradiance faces.
+   */
+  EnvironmentPrefilter(
+      int size = 128,
+      int levels = 6,
+      int samples = 64,
+      int irradianceSize = 32);
+
+  /**
+   Filters an environment map.
+   
+   The input is either an equirectangular RGB(A) image or a cube map with
+   the 6 faces stacked vertically, either 8 bit or floating point.
+   */
+  PrefilteredEnvironment operator() (const cv::Mat &image) const;
+
+ private:
+  /// Size of the largest specular level.
+  const int size_;
+  /// Number of specular levels.
+  const int levels_;
+  /// Number of samples per texel.
+  const int samples_;
+  /// Size of the irradiance map.
+  const int irradianceSize_;
+};
+
+}
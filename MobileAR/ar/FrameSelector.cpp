@@ -0,0 +1,100 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <cassert>
+
+#include "ar/FrameSelector.h"
+
+
+namespace ar {
+
+FrameSelector::FrameSelector(size_t capacity, float maxAngle)
+  : capacity_(capacity)
+  , maxAngle_(maxAngle)
+  , buffer_(capacity)
+  , count_(0)
+  , selectedTag_(0)
+{
+  assert(capacity_ > 0);
+}
+
+
+bool FrameSelector::Add(const std::vector<HDRFrame> &frames, uint64_t tag) {
+  if (frames.empty()) {
+    return false;
+  }
+
+  // Brackets too far from the first one start a new position. At most one
+  // position is completed by a bracket, so a buffer filled by the bracket
+  // which completed the previous position is handed over with the next one.
+  const Eigen::Quaternion<float> q(frames[0].R);
+  bool completed = false;
+  if (count_ == capacity_ || (count_ > 0 && q_.angularDistance(q) > maxAngle_)) {
+    Select();
+    completed = true;
+  }
+  if (count_ == 0) {
+    q_ = q;
+  }
+
+  // Score the middle exposure, which is the best exposed one. Gray image
+  // and pyramid buffers are reused, so scoring does not allocate.
+  const auto &reference = frames[frames.size() / 2];
+  cv::cvtColor(reference.bgr, gray_, CV_BGR2GRAY);
+  float per, blur;
+  std::tie(per, blur) = detector_(gray_);
+
+  // Frames are copied into the slot, which keeps its capacity. They cannot
+  // be assigned, as their members are constant.
+  auto &entry = buffer_[count_++];
+  entry.frames.clear();
+  for (const auto &frame : frames) {
+    entry.frames.push_back(frame);
+  }
+  entry.score = per - blur;
+  entry.tag = tag;
+
+  // If the user keeps still, do not hold on to frames forever.
+  if (count_ == capacity_ && !completed) {
+    Select();
+    completed = true;
+  }
+  return completed;
+}
+
+
+std::vector<HDRFrame> FrameSelector::Take(uint64_t *tag) {
+  if (selected_.empty()) {
+    Select();
+  }
+  if (tag) {
+    *tag = selectedTag_;
+  }
+  return std::move(selected_);
+}
+
+
+void FrameSelector::Select() {
+  if (count_ == 0) {
+    return;
+  }
+  assert(selected_.empty() && "Take must be called after each completed position");
+
+  auto best = buffer_.begin();
+  for (auto it = buffer_.begin(); it != buffer_.begin() + count_; ++it) {
+    if (it->score > best->score) {
+      best = it;
+    }
+  }
+  selected_ = std::move(best->frames);
+  selectedTag_ = best->tag;
+
+  // Drop references to the other images, keeping the slots.
+  for (size_t i = 0; i < count_; ++i) {
+    buffer_[i].frames.clear();
+  }
+  count_ = 0;
+}
+
+}
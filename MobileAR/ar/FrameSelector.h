@@ -0,0 +1,96 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Eigen>
+#include <opencv2/opencv.hpp>
+
+#include "ar/BlurDetector.h"
+#include "ar/EnvironmentBuilder.h"
+
+
+namespace ar {
+
+/**
+ Selects the sharpest bracket among those taken at a capture position.
+ 
+ Brackets are scored as they arrive and kept in a small buffer as long as
+ the camera points in the same direction. When the camera moves away or the
+ buffer fills up, the sharpest bracket is handed over to the caller.
+ */
+class FrameSelector {
+ public:
+  /**
+   Creates a new selector.
+   
+   @param capacity Maximal number of brackets kept for a position.
+   @param maxAngle Angle between brackets of the same position.
+   */
+  FrameSelector(size_t capacity = 5, float maxAngle = 2.0f * M_PI / 180.0f);
+  
+  /**
+   Scores a bracket and adds it to the buffer of the current position.
+   
+   @param tag Identifier of the bracket, returned by Take if it is selected.
+   @return True if a position was completed and a bracket can be taken. The
+           caller must Take it before adding the next bracket.
+   */
+  bool Add(const std::vector<HDRFrame> &frames, uint64_t tag = 0);
+  
+  /**
+   Returns the sharpest bracket of the last completed position. If there is
+   none, the buffer of the current position is flushed instead.
+   
+   @param tag If not null, receives the identifier of the bracket.
+   */
+  std::vector<HDRFrame> Take(uint64_t *tag = nullptr);
+  
+  /**
+   Returns the number of brackets buffered for the current position.
+   */
+  size_t Size() const { return count_; }
+  
+ private:
+  /**
+   Bracket in the buffer.
+   */
+  struct Entry {
+    /// Frames of the bracket.
+    std::vector<HDRFrame> frames;
+    /// Sharpness of the reference exposure.
+    float score;
+    /// Identifier of the bracket.
+    uint64_t tag;
+  };
+  
+  /**
+   Moves the sharpest bracket from the buffer to the selection.
+   */
+  void Select();
+  
+ private:
+  /// Maximal number of brackets for a position.
+  const size_t capacity_;
+  /// Maximal angle between brackets of a position.
+  const float maxAngle_;
+  /// Buffer of brackets, slots are reused between positions.
+  std::vector<Entry> buffer_;
+  /// Number of brackets in the buffer.
+  size_t count_;
+  /// Orientation of the current position.
+  Eigen::Quaternion<float> q_;
+  /// Sharpest bracket of the last completed position.
+  std::vector<HDRFrame> selected_;
+  /// Identifier of the selected bracket.
+  uint64_t selectedTag_;
+  /// Detector scoring frames, reusing its pyramid between frames.
+  BlurDetector detector_;
+  /// Grayscale image of the reference exposure.
+  cv::Mat gray_;
+};
+
+}
@@ -0,0 +1,267 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <limits>
+#include <random>
+
+#include "ar/ImportanceSampler.h"
+#include "ar/Parallel.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Largest float below one. Uniform float distributions might return one.
+constexpr float kBelowOne = 1.0f - std::numeric_limits<float>::epsilon() / 2.0f;
+
+/**
+ Builds a Walker alias table with Vose's method. Zero weights degenerate
+ to a uniform distribution.
+ */
+template<typename Alias>
+void BuildAlias(
+    const double *w,
+    int n,
+    double sum,
+    Alias *table,
+    std::vector<double> &p,
+    std::vector<int> &small,
+    std::vector<int> &large)
+{
+  if (sum <= 0.0) {
+    for (int i = 0; i < n; ++i) {
+      table[i] = { 1.0f, i };
+    }
+    return;
+  }
+
+  p.resize(n);
+  small.clear();
+  large.clear();
+  for (int i = 0; i < n; ++i) {
+    p[i] = w[i] * n / sum;
+    (p[i] < 1.0 ? small : large).push_back(i);
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const int s = small.back(); small.pop_back();
+    const int l = large.back(); large.pop_back();
+    table[s] = { static_cast<float>(p[s]), l };
+    p[l] = (p[l] + p[s]) - 1.0;
+    (p[l] < 1.0 ? small : large).push_back(l);
+  }
+
+  // Leftovers are 1 up to rounding errors.
+  for (const int i : small) {
+    table[i] = { 1.0f, i };
+  }
+  for (const int i : large) {
+    table[i] = { 1.0f, i };
+  }
+}
+
+/**
+ Builds a CDF with n + 1 entries. Zero weights degenerate to uniform.
+ */
+void BuildCDF(const double *w, int n, double sum, float *cdf) {
+  double acc = 0.0;
+  cdf[0] = 0.0f;
+  for (int i = 0; i < n; ++i) {
+    acc += sum > 0.0 ? w[i] / sum : 1.0 / n;
+    cdf[i + 1] = static_cast<float>(acc);
+  }
+  cdf[n] = 1.0f;
+}
+
+/**
+ Picks an entry from an alias table, remapping the number to [0, 1).
+ */
+template<typename Alias>
+int SelectAlias(const Alias *table, int n, float u, float &f) {
+  const float x = u * n;
+  const int i = std::min(static_cast<int>(x), n - 1);
+  const float g = std::min(std::max(x - i, 0.0f), kBelowOne);
+
+  const auto &e = table[i];
+  if (g < e.prob || e.prob >= 1.0f) {
+    f = g / e.prob;
+    return i;
+  }
+  f = (g - e.prob) / (1.0f - e.prob);
+  return e.alias;
+}
+
+/**
+ Picks an entry from a CDF, remapping the number to [0, 1).
+ */
+int SelectCDF(const float *cdf, int n, float u, float &f) {
+  const int i = std::min(
+      std::max(static_cast<int>(std::upper_bound(cdf, cdf + n + 1, u) - cdf) - 1, 0),
+      n - 1
+  );
+  const float width = cdf[i + 1] - cdf[i];
+  f = width > 0.0f ? std::min(std::max((u - cdf[i]) / width, 0.0f), 1.0f) : 0.5f;
+  return i;
+}
+
+}
+
+
+ImportanceSampler::ImportanceSampler(const cv::Mat &image)
+  : rows_(image.rows)
+  , cols_(image.cols)
+  , image_(image.rows, image.cols, CV_32FC3)
+  , pdf_(image.rows * image.cols)
+  , marginal_(image.rows + 1)
+  , conditional_(image.rows * (image.cols + 1))
+  , rowAlias_(image.rows)
+  , colAlias_(image.rows * image.cols)
+{
+  const int chan = image.channels();
+  if (chan != 3 && chan != 4) {
+    throw std::runtime_error("Image must be either RGB or RGBA.");
+  }
+  if (image.depth() != CV_8U && image.depth() != CV_32F) {
+    throw std::runtime_error("Image must be 8 bit or floating point.");
+  }
+  const float scale = image.depth() == CV_8U ? 1.0f / 255.0f : 1.0f;
+
+  // Single parallel pass over the rows: convert the pixels, weight them and
+  // build the conditional CDF and alias table of each row.
+  std::vector<double> weights(rows_ * cols_);
+  std::vector<double> rowSum(rows_);
+  ParallelFor(0, kParallelStripes, [&](int stripe) {
+    std::vector<double> p;
+    std::vector<int> small, large;
+
+    const int r0 = rows_ * (stripe + 0) / kParallelStripes;
+    const int r1 = rows_ * (stripe + 1) / kParallelStripes;
+    for (int r = r0; r < r1; ++r) {
+      const double sinTheta = std::max(std::cos(M_PI / 2.0 - M_PI * (r + 0.5) / rows_), 0.0);
+
+      auto dst = image_.ptr<cv::Vec3f>(r);
+      double *w = &weights[r * cols_];
+      double sum = 0.0;
+      for (int c = 0; c < cols_; ++c) {
+        if (image.depth() == CV_8U) {
+          const auto *pix = &image.ptr<uint8_t>(r)[c * chan];
+          dst[c] = cv::Vec3f(pix[0] * scale, pix[1] * scale, pix[2] * scale);
+        } else {
+          const auto *pix = &image.ptr<float>(r)[c * chan];
+          dst[c] = cv::Vec3f(pix[0], pix[1], pix[2]);
+        }
+        const auto &pix = dst[c];
+        w[c] = std::max(pix[0] * 0.2125 + pix[1] * 0.7154 + pix[2] * 0.0721, 0.0) * sinTheta;
+        sum += w[c];
+      }
+      rowSum[r] = sum;
+
+      BuildCDF(w, cols_, sum, &conditional_[r * (cols_ + 1)]);
+      BuildAlias(w, cols_, sum, &colAlias_[r * cols_], p, small, large);
+    }
+  });
+
+  // Marginal distribution over the rows.
+  double total = 0.0;
+  for (const auto &sum : rowSum) {
+    total += sum;
+  }
+  {
+    std::vector<double> p;
+    std::vector<int> small, large;
+    BuildCDF(rowSum.data(), rows_, total, marginal_.data());
+    BuildAlias(rowSum.data(), rows_, total, rowAlias_.data(), p, small, large);
+  }
+
+  // Discrete probabilities of the texels.
+  for (int r = 0; r < rows_; ++r) {
+    for (int c = 0; c < cols_; ++c) {
+      const int i = r * cols_ + c;
+      pdf_[i] = static_cast<float>(total > 0.0 ? weights[i] / total : 1.0 / (rows_ * cols_));
+    }
+  }
+}
+
+
+ImportanceSampler::Sample ImportanceSampler::sample(float u0, float u1) const {
+  float fy, fx;
+  const int y = SelectAlias(rowAlias_.data(), rows_, u0, fy);
+  const int x = SelectAlias(&colAlias_[y * cols_], cols_, u1, fx);
+  return make(y, x, fy, fx);
+}
+
+
+ImportanceSampler::Sample ImportanceSampler::warp(float u0, float u1) const {
+  float fy, fx;
+  const int y = SelectCDF(marginal_.data(), rows_, u0, fy);
+  const int x = SelectCDF(&conditional_[y * (cols_ + 1)], cols_, u1, fx);
+  return make(y, x, fy, fx);
+}
+
+
+std::vector<ImportanceSampler::Sample> ImportanceSampler::draw(
+    size_t count,
+    uint32_t seed) const
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+  std::vector<Sample> samples;
+  samples.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const float u0 = uniform(generator);
+    const float u1 = uniform(generator);
+    samples.push_back(sample(u0, u1));
+  }
+  return samples;
+}
+
+
+float ImportanceSampler::pdf(const cv::Vec3f &d) const {
+  const float norm = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  if (norm <= 0.0f) {
+    return 0.0f;
+  }
+
+  // Find the texel the direction falls into.
+  const float phi = std::asin(std::min(std::max(d[2] / norm, -1.0f), 1.0f));
+  float theta = std::atan2(d[1], d[0]);
+  if (theta < 0.0f) {
+    theta += static_cast<float>(2.0 * M_PI);
+  }
+  const int y = std::min(std::max(static_cast<int>((M_PI / 2.0 - phi) / M_PI * rows_), 0), rows_ - 1);
+  const int x = std::min(std::max(static_cast<int>(theta / (2.0 * M_PI) * cols_), 0), cols_ - 1);
+
+  // Convert the density from the image to the sphere.
+  const float sinTheta = std::cos(phi);
+  if (sinTheta <= 0.0f) {
+    return 0.0f;
+  }
+  return static_cast<float>(pdf_[y * cols_ + x] * rows_ * cols_ / (2.0 * M_PI * M_PI * sinTheta));
+}
+
+
+ImportanceSampler::Sample ImportanceSampler::make(int y, int x, float fy, float fx) const {
+
+  // Jitter the direction inside the texel.
+  const double phi = M_PI / 2.0 - M_PI * (y + fy) / rows_;
+  const double theta = 2.0 * M_PI * (x + fx) / cols_;
+  const double sinTheta = std::max(std::cos(phi), 1e-6);
+
+  return {
+    cv::Vec3f(
+        static_cast<float>(std::cos(phi) * std::cos(theta)),
+        static_cast<float>(std::cos(phi) * std::sin(theta)),
+        static_cast<float>(std::sin(phi))
+    ),
+    image_.at<cv::Vec3f>(y, x),
+    static_cast<float>(pdf_[y * cols_ + x] * rows_ * cols_ / (2.0 * M_PI * M_PI * sinTheta)),
+    y,
+    x
+  };
+}
+
+}
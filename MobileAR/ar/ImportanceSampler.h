@@ -0,0 +1,101 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Importance sampling of equirectangular environment maps.
+ 
+ Texels are weighted by luminance and by the sine of the polar angle. Both
+ a marginal/conditional CDF and Walker alias tables are built, so directions
+ can be drawn either in O(1) or by inverting the CDF, which preserves the
+ stratification of the input numbers.
+ */
+class ImportanceSampler {
+ public:
+  /**
+   Direction drawn from the environment.
+   */
+  struct Sample {
+    /// Direction towards the environment.
+    cv::Vec3f direction;
+    /// RGB radiance of the texel.
+    cv::Vec3f radiance;
+    /// Probability density with respect to solid angle.
+    float pdf;
+    /// Row of the texel.
+    int y;
+    /// Column of the texel.
+    int x;
+  };
+
+  /**
+   Builds the tables from an 8 bit or floating point RGB(A) image.
+   */
+  ImportanceSampler(const cv::Mat &image);
+
+  /**
+   Draws a direction from two uniform numbers using the alias tables.
+   */
+  Sample sample(float u0, float u1) const;
+
+  /**
+   Draws a direction from two uniform numbers by inverting the CDFs.
+   */
+  Sample warp(float u0, float u1) const;
+
+  /**
+   Draws a number of directions from a seeded generator.
+   */
+  std::vector<Sample> draw(size_t count, uint32_t seed = 0) const;
+
+  /**
+   Evaluates the probability density of a direction.
+   */
+  float pdf(const cv::Vec3f &direction) const;
+
+ private:
+  /**
+   Entry of an alias table.
+   */
+  struct Alias {
+    /// Probability of keeping the entry.
+    float prob;
+    /// Entry picked otherwise.
+    int alias;
+  };
+
+  /**
+   Builds the sample for a continuous position in the image.
+   */
+  Sample make(int y, int x, float fy, float fx) const;
+
+ private:
+  /// Number of rows.
+  const int rows_;
+  /// Number of columns.
+  const int cols_;
+  /// Floating point RGB image.
+  cv::Mat image_;
+  /// Probability of each texel.
+  std::vector<float> pdf_;
+  /// Marginal CDF over rows.
+  std::vector<float> marginal_;
+  /// Conditional CDFs of each row.
+  std::vector<float> conditional_;
+  /// Alias table over rows.
+  std::vector<Alias> rowAlias_;
+  /// Alias tables of each row.
+  std::vector<Alias> colAlias_;
+};
+
+}
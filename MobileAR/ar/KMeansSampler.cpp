@@ -0,0 +1,294 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include "KMeansSampler.h"
+#include "Parallel.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Texels darker than this fraction of the mean luminance are ignored.
+constexpr float kMinLuminance = 0.05f;
+/// Maximal number of Lloyd iterations per split.
+constexpr int kIterations = 10;
+/// Centres moving less than this (1 - cos of angle) have converged.
+constexpr float kConvergence = 1e-6f;
+/// Clusters smaller than this are reduced on a single thread.
+constexpr int kMinParallel = 1 << 14;
+
+
+/**
+ Reorders a segment of an array, moving element order[i] to position i.
+ */
+template<typename T>
+void Permute(T &array, int begin, const std::vector<int> &order) {
+  const T tmp = array.segment(begin, order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    array[begin + i] = tmp[order[i]];
+  }
+}
+
+
+/**
+ Picks the index of an element with a probability proportional to its weight.
+ */
+int PickWeighted(const Eigen::ArrayXf &weights, float u) {
+  const float target = u * weights.sum();
+  float sum = 0.0f;
+  for (int i = 0; i < weights.size(); ++i) {
+    sum += weights[i];
+    if (sum > target) {
+      return i;
+    }
+  }
+  return static_cast<int>(weights.size() - 1);
+}
+
+}
+
+
+KMeansSampler::KMeansSampler(size_t depth, const cv::Mat &image, uint32_t seed)
+  : LightProbeSampler(depth, image)
+  , seed_(seed)
+{
+}
+
+
+int KMeansSampler::split(const Region &region, int depth) {
+  // Find the threshold for bright texels.
+  double mean = 0.0;
+  for (int r = region.y0; r <= region.y1; ++r) {
+    const auto pl = illum_.ptr<float>(r);
+    for (int c = region.x0; c <= region.x1; ++c) {
+      mean += pl[c];
+    }
+  }
+  const float threshold = std::max(mean / region.area() * kMinLuminance, 1e-9);
+
+  // Gather the directions of the bright texels.
+  int count = 0;
+  for (int r = region.y0; r <= region.y1; ++r) {
+    const auto pl = illum_.ptr<float>(r);
+    for (int c = region.x0; c <= region.x1; ++c) {
+      count += pl[c] > threshold;
+    }
+  }
+  x_.resize(count);
+  y_.resize(count);
+  z_.resize(count);
+  w_.resize(count);
+  row_.resize(count);
+  col_.resize(count);
+
+  int i = 0;
+  for (int r = region.y0; r <= region.y1; ++r) {
+    const auto pl = illum_.ptr<float>(r);
+    const auto phi = static_cast<float>(M_PI / 2.0 - M_PI * r / illum_.rows);
+    for (int c = region.x0; c <= region.x1; ++c) {
+      if (pl[c] <= threshold) {
+        continue;
+      }
+      const auto theta = static_cast<float>(2 * M_PI * c / illum_.cols);
+      x_[i] = std::cos(phi) * std::cos(theta);
+      y_[i] = std::cos(phi) * std::sin(theta);
+      z_[i] = std::sin(phi);
+      w_[i] = pl[c];
+      row_[i] = r;
+      col_[i] = c;
+      ++i;
+    }
+  }
+
+  return cluster(0, count, depth);
+}
+
+
+int KMeansSampler::cluster(int begin, int end, int depth) {
+  // Aggregate the light of all texels, so all depths can be queried.
+  const int node = static_cast<int>(tree_.size());
+  tree_.push_back({ light(begin, end), static_cast<size_t>(depth), -1, -1 });
+
+  // If max depth was reached or texels cannot be split, the node is a leaf.
+  if (depth >= depth_ || end - begin < 2) {
+    return node;
+  }
+  const int mid = bisect(begin, end, node);
+  if (mid == begin || mid == end) {
+    return node;
+  }
+
+  const int left = cluster(begin, mid, depth + 1);
+  const int right = cluster(mid, end, depth + 1);
+  tree_[node].left = left;
+  tree_[node].right = right;
+  return node;
+}
+
+
+int KMeansSampler::bisect(int begin, int end, int node) {
+  const int n = end - begin;
+  const auto x = x_.segment(begin, n);
+  const auto y = y_.segment(begin, n);
+  const auto z = z_.segment(begin, n);
+  const auto w = w_.segment(begin, n);
+
+  // Seed the first centre with a bright texel and the second one with a
+  // texel far away from it, as in k-means++. The generator depends on the
+  // node only, so the result is deterministic.
+  std::mt19937 gen(seed_ + static_cast<uint32_t>(node) * 0x9E3779B9u);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+  const int i0 = PickWeighted(w, uniform(gen));
+  Eigen::Vector3f c0(x[i0], y[i0], z[i0]);
+  const Eigen::ArrayXf far = w * (1.0f - (x * c0.x() + y * c0.y() + z * c0.z())).max(0.0f);
+  if (far.sum() <= 0.0f) {
+    return begin;
+  }
+  const int i1 = PickWeighted(far, uniform(gen));
+  Eigen::Vector3f c1(x[i1], y[i1], z[i1]);
+
+  // Texels are closer to c0 if they are on the positive side of the plane
+  // bisecting the two centres, so a single dot product assigns them.
+  Eigen::ArrayXf score(n);
+  for (int iter = 0; iter < kIterations; ++iter) {
+    const Eigen::Vector3f d = c0 - c1;
+    score = x * d.x() + y * d.y() + z * d.z();
+
+    // Sum up the weighted directions of both clusters in fixed stripes.
+    const int stripes = n < kMinParallel ? 1 : kParallelStripes;
+    std::vector<Eigen::Matrix<double, 6, 1>> partial(stripes);
+    ParallelFor(0, stripes, [&](int stripe) {
+      const int s0 = n * (stripe + 0) / stripes;
+      const int s1 = n * (stripe + 1) / stripes;
+      const auto ws = w.segment(s0, s1 - s0);
+      const Eigen::ArrayXf w0 = (score.segment(s0, s1 - s0) >= 0.0f).select(ws, 0.0f);
+      const Eigen::ArrayXf w1 = ws - w0;
+
+      auto &p = partial[stripe];
+      p[0] = (w0 * x.segment(s0, s1 - s0)).sum();
+      p[1] = (w0 * y.segment(s0, s1 - s0)).sum();
+      p[2] = (w0 * z.segment(s0, s1 - s0)).sum();
+      p[3] = (w1 * x.segment(s0, s1 - s0)).sum();
+      p[4] = (w1 * y.segment(s0, s1 - s0)).sum();
+      p[5] = (w1 * z.segment(s0, s1 - s0)).sum();
+    });
+    Eigen::Matrix<double, 6, 1> sum = Eigen::Matrix<double, 6, 1>::Zero();
+    for (const auto &p : partial) {
+      sum += p;
+    }
+
+    // Move the centres to the normalized means.
+    const Eigen::Vector3f m0 = sum.head<3>().cast<float>();
+    const Eigen::Vector3f m1 = sum.tail<3>().cast<float>();
+    if (m0.norm() < 1e-9f || m1.norm() < 1e-9f) {
+      break;
+    }
+    const Eigen::Vector3f n0 = m0.normalized();
+    const Eigen::Vector3f n1 = m1.normalized();
+    const bool converged =
+        n0.dot(c0) > 1.0f - kConvergence &&
+        n1.dot(c1) > 1.0f - kConvergence;
+    c0 = n0;
+    c1 = n1;
+    if (converged) {
+      break;
+    }
+  }
+
+  // Partition the texels so both clusters are contiguous.
+  const Eigen::Vector3f d = c0 - c1;
+  score = x * d.x() + y * d.y() + z * d.z();
+
+  std::vector<int> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  const auto mid = std::stable_partition(order.begin(), order.end(), [&](int i) {
+    return score[i] >= 0.0f;
+  });
+  const int split = begin + static_cast<int>(mid - order.begin());
+
+  Permute(x_, begin, order);
+  Permute(y_, begin, order);
+  Permute(z_, begin, order);
+  Permute(w_, begin, order);
+  Permute(row_, begin, order);
+  Permute(col_, begin, order);
+  return split;
+}
+
+
+LightSource KMeansSampler::light(int begin, int end) const {
+  const int rows = illum_.rows;
+  const int cols = illum_.cols;
+  const int n = end - begin;
+  if (n == 0) {
+    return {
+      LightVector{ 0.0f, 0.0f, -1.0f },
+      LightVector{ 0.0f, 0.0f, 0.0f },
+      LightVector{ 0.0f, 0.0f, 0.0f },
+      LightVector{ 0.0f, 0.0f, 0.0f },
+      { 0, 0, rows - 1, cols - 1 },
+      0,
+      0,
+      0.0f
+    };
+  }
+
+  // Sum up colours, directions and the bounding box of texels.
+  double sumR = 0.0, sumG = 0.0, sumB = 0.0, area = 0.0;
+  Eigen::Vector3d dir = Eigen::Vector3d::Zero();
+  int y0 = rows - 1, x0 = cols - 1, y1 = 0, x1 = 0;
+  for (int i = begin; i < end; ++i) {
+    const auto &pix = image_.at<cv::Vec3f>(row_[i], col_[i]);
+    sumR += pix[0];
+    sumG += pix[1];
+    sumB += pix[2];
+    dir += w_[i] * Eigen::Vector3d(x_[i], y_[i], z_[i]);
+    area += std::sqrt(std::max(1.0f - z_[i] * z_[i], 0.0f)) / 2.0;
+
+    y0 = std::min(y0, row_[i]);
+    x0 = std::min(x0, col_[i]);
+    y1 = std::max(y1, row_[i]);
+    x1 = std::max(x1, col_[i]);
+  }
+
+  // Normalize colours the same way as the cut samplers.
+  const double scale = (4 * M_PI * area) / (static_cast<double>(n) * cols * cols);
+  const float r = sumR * scale;
+  const float g = sumG * scale;
+  const float b = sumB * scale;
+
+  // Find the centroid in the image.
+  const Eigen::Vector3f v = dir.norm() > 1e-9
+      ? Eigen::Vector3f(dir.normalized().cast<float>())
+      : Eigen::Vector3f(0.0f, 0.0f, 1.0f);
+  const float phi = std::asin(std::min(std::max(v.z(), -1.0f), 1.0f));
+  float theta = std::atan2(v.y(), v.x());
+  if (theta < 0.0f) {
+    theta += 2 * M_PI;
+  }
+  const int y = std::min(std::max(
+      static_cast<int>((M_PI / 2.0 - phi) / M_PI * rows), 0), rows - 1);
+  const int x = std::min(std::max(
+      static_cast<int>(theta / (2 * M_PI) * cols), 0), cols - 1);
+
+  // Create the light source.
+  return {
+    LightVector{ -v.x(), -v.y(), -v.z() },
+    LightVector{ 0.0f, 0.0f, 0.0f },
+    LightVector{ r, g, b },
+    LightVector{ r, g, b },
+    { y0, x0, y1, x1 },
+    y,
+    x,
+    static_cast<float>(area)
+  };
+}
+
+}
@@ -0,0 +1,64 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+
+#include <Eigen/Eigen>
+
+#include "LightProbeSampler.h"
+
+namespace ar {
+
+/**
+ Class that clusters bright texels on the unit sphere.
+
+ Texels are weighted by luminance and split in two by spherical k-means,
+ recursively, so lights are not constrained to rectangles in the image and
+ sources crossing the seam or close to the poles are kept together.
+ */
+class KMeansSampler : public LightProbeSampler {
+ public:
+  /**
+   Initializes the sampler.
+
+   @param seed Seed of the initial centres, results are deterministic.
+   */
+  KMeansSampler(size_t depth, const cv::Mat &image, uint32_t seed = 0);
+
+ private:
+  /**
+   Gathers the bright texels of a region and clusters them.
+   */
+  int split(const Region &region, int depth);
+
+  /**
+   Creates a node for the texels in [begin, end) and splits them in two.
+   */
+  int cluster(int begin, int end, int depth);
+
+  /**
+   Splits texels into two clusters, returning the index of the first texel
+   of the second cluster.
+   */
+  int bisect(int begin, int end, int node);
+
+  /**
+   Creates a light source out of the texels in [begin, end).
+   */
+  LightSource light(int begin, int end) const;
+
+ private:
+  /// Seed of the initial centres.
+  const uint32_t seed_;
+  /// Directions of the texels.
+  Eigen::ArrayXf x_, y_, z_;
+  /// Luminance weight of texels.
+  Eigen::ArrayXf w_;
+  /// Position of the texels in the image.
+  Eigen::ArrayXi row_, col_;
+};
+
+}
@@ -4,421 +4,308 @@
 
 #pragma once
 
-#include <Eigen/Eigen>
+#include <array>
+#include <cmath>
 
-#include "ar/Jet.h"
+#include <Eigen/Eigen>
 
 
 namespace ar {
 
 /**
- Wrapper around Extended Kalman Filters.
+ Error-state Kalman filter estimating the pose of the camera.
+
+ The nominal state consists of the position and velocity of the camera in
+ the world frame, its orientation and the biases of the gyroscope and the
+ accelerometer. The filter estimates the 15-dimensional error of this state,
+ where the attitude error is a small rotation applied to the orientation on
+ the left. Gyroscope and accelerometer samples drive the propagation of the
+ state through Predict, while attitude and marker poses correct it, so the
+ gain is only computed when measurements arrive. All Jacobians are in closed
+ form and sparse blocks are never multiplied.
 
- @tparam T Type of the data (usually float/double).
- @tparam N Number of elements in the state vector.
- @tparam WN Number of elements in the process noise covariance.
+ Orientations map from the world frame to the camera frame, matching the
+ convention of the view matrix.
+
+ @tparam T Datatype used by the filter.
  */
-template<typename T, size_t N, size_t WN>
-class KalmanFilter {
-public:
+template<typename T>
+class EKFPose {
+ public:
+  typedef Eigen::Matrix<T, 3, 1> Vector;
+  typedef Eigen::Matrix<T, 3, 3> Matrix;
+  typedef Eigen::Quaternion<T> Quaternion;
 
-  /**
-   Creates the Kalman filter.
-   */
-  KalmanFilter(const Eigen::Matrix<T, WN, WN> &q)
-    : q_(q)
-  {
-  }
+  /// Dimension of the error state.
+  static constexpr int kStates = 15;
 
   /**
-   Creates the Kalman filter with an initial state and covariance.
+   Creates the Kalman filter.
    */
-  KalmanFilter(
-      const Eigen::Matrix<T, WN, WN> &q,
-      const Eigen::Matrix<T, N, 1> &x,
-      const Eigen::Matrix<T, N, N> &p)
-    : q_(q)
-    , x_(x)
-    , p_(p)
+  EKFPose()
+    : p_(Vector::Zero())
+    , v_(Vector::Zero())
+    , q_(Quaternion::Identity())
+    , bg_(Vector::Zero())
+    , ba_(Vector::Zero())
+    , hasAttitude_(false)
+    , hasPosition_(false)
   {
+    // Initial uncertainty.
+    cov_.setZero();
+    cov_.diagonal() <<
+        1e2, 1e2, 1e2,
+        1e2, 1e2, 1e2,
+        1e-1, 1e-1, 1e-1,
+        1e-4, 1e-4, 1e-4,
+        1e1, 1e1, 1e1;
+
+    // Process noise: gyro & accelerometer noise, bias random walks.
+    qw_ = 1e-4;
+    qa_ = 1e2;
+    qbg_ = 1e-6;
+    qba_ = 1e-2;
+
+    // Measurement noise: IMU attitude, marker attitude & marker position.
+    rI_ = 4e-3;
+    rMq_ = 1e-2;
+    rMp_ = 1e-0;
   }
 
   /**
-   Destroys the Kalman filter.
-   */
-  virtual ~KalmanFilter() {
-  }
+   Propagates the state and the covariance with an IMU sample. This is
+   cheap enough to run at the full rate of the sensors.
 
-  /**
-   Performs an update on the Kalman Filter.
+   @param wm Angular velocity, in rad/s.
+   @param am Acceleration without gravity in the camera frame, in cm/s^2.
    */
-  template<typename Updater, size_t M, size_t WM>
-  void Update(
-      const T &dt,
-      const Eigen::Matrix<T, M, 1> zm,
-      const Eigen::Matrix<T, WM, WM> &r)
-  {
-
-    // Convert the state to jet form, compute both the projected state and the Jacobian.
-    // Extract the new state & the Jacobian matrix.
-    Eigen::Matrix<T, N, 1> x;
-    Eigen::Matrix<T, N, N> F;
-    Eigen::Matrix<T, N, WN> WF;
-    {
-      Eigen::Matrix<Jet<T, N + WN>, N, 1> xjet;
-      Eigen::Matrix<Jet<T, N + WN>, WN, 1> wjet;
-
-      for (size_t i = 0; i < N; ++i) {
-        xjet(i).s = x_(i);
-        xjet(i).e(i) = 1;
-      }
-      for (size_t i = 0; i < WN; ++i) {
-        wjet(i).s = 0;
-        wjet(i).e(i + N) = 1;
-      }
-
-      const auto xj = Updater::Update(xjet, wjet, Jet<T, N + WN>(dt));
-
-      for (size_t i = 0; i < N; ++i) {
-        x(i) = xj(i).s;
-        for (size_t j = 0; j < N; ++j) {
-          F(i, j) = xj(i).e(j);
-        }
-        for (size_t j = 0; j < WN; ++j) {
-          WF(i, j) = xj(i).e(j + N);
-        }
-      }
+  void Predict(const Vector &wm, const Vector &am, const T &dt) {
+    if (!hasAttitude_) {
+      return;
     }
 
-    // Project ahead the covariance matrix.
-    Eigen::Matrix<T, N, N> p = F * p_ * F.transpose() + WF * q_ * WF.transpose();
-
-    // Extract the measurement vector and Jacobian.
-    Eigen::Matrix<T, M, 1> z;
-    Eigen::Matrix<T, M, N> H;
-    Eigen::Matrix<T, M, WM> WH;
-    {
-      Eigen::Matrix<Jet<T, N + WM>, N, 1> zjet;
-      Eigen::Matrix<Jet<T, N + WM>, WM, 1> wjet;
-      for (size_t i = 0; i < N; ++i) {
-        zjet(i).s = x(i);
-        zjet(i).e(i) = 1;
-      }
-      for (size_t i = 0; i < WM; ++i) {
-        wjet(i).s = 0;
-        wjet(i).e(i + N) = 1;
-      }
-
-      const auto zj = Updater::Measure(zjet, wjet);
-
-      for (size_t i = 0; i < M; ++i) {
-        z(i) = zj(i).s;
-        for (size_t j = 0; j < N; ++j) {
-          H(i, j) = zj(i).e(j);
-        }
-        for (size_t j = 0; j < WM; ++j) {
-          WH(i, j) = zj(i).e(j + N);
-        }
-      }
-    }
-
-    // Compute the Kalman gain.
-    const auto k = p * H.transpose() * (
-        H * p * H.transpose() + WH * r * WH.transpose()
-    ).inverse();
-
-    // Update the state estimate.
-    x_ = x + k * (zm - z);
-
-    // Update the covariance.
-    p_ = (Eigen::Matrix<T, N, N>::Identity() - k * H) * p;
+    // Propagate the nominal state. Gravity is already removed from the
+    // acceleration, which is rotated into the world frame.
+    const Vector w = wm - bg_;
+    const Vector a = am - ba_;
+    const Matrix rt = q_.toRotationMatrix().transpose();
+    const Vector aw = rt * a;
+    const Quaternion dq = Exp(w * dt);
+    p_ += v_ * dt + aw * (dt * dt / T(2));
+    v_ += aw * dt;
+    q_ = (dq * q_).normalized();
+
+    // Non-identity blocks of the error-state transition matrix F.
+    const Matrix fvt = rt * Skew(a) * dt;
+    const Matrix fva = -rt * dt;
+    const Matrix ftt = dq.toRotationMatrix();
+
+    // P = F * P * F^T, applied first to rows, then to columns. Blocks are
+    // updated in an order which only reads blocks not yet overwritten.
+    cov_.template middleRows<3>(kP) += dt * cov_.template middleRows<3>(kV);
+    cov_.template middleRows<3>(kV) +=
+        fvt * cov_.template middleRows<3>(kTheta) +
+        fva * cov_.template middleRows<3>(kBA);
+    cov_.template middleRows<3>(kTheta) =
+        ftt * cov_.template middleRows<3>(kTheta) -
+        dt * cov_.template middleRows<3>(kBG);
+
+    cov_.template middleCols<3>(kP) += dt * cov_.template middleCols<3>(kV);
+    cov_.template middleCols<3>(kV) +=
+        cov_.template middleCols<3>(kTheta) * fvt.transpose() +
+        cov_.template middleCols<3>(kBA) * fva.transpose();
+    cov_.template middleCols<3>(kTheta) =
+        cov_.template middleCols<3>(kTheta) * ftt.transpose() -
+        dt * cov_.template middleCols<3>(kBG);
+
+    // Add the process noise.
+    cov_.diagonal().template segment<3>(kV).array() += qa_ * dt * dt;
+    cov_.diagonal().template segment<3>(kTheta).array() += qw_ * dt * dt;
+    cov_.diagonal().template segment<3>(kBG).array() += qbg_ * dt;
+    cov_.diagonal().template segment<3>(kBA).array() += qba_ * dt;
   }
 
   /**
-   Returns the state.
+   Corrects the state with the attitude reported by the device.
    */
-  Eigen::Matrix<T, N, 1> GetState() {
-    return x_;
+  void CorrectAttitude(const Quaternion &q) {
+    if (!hasAttitude_) {
+      q_ = q.normalized();
+      hasAttitude_ = true;
+      return;
+    }
+    Correct<1>({ kTheta }, Log(q * q_.inverse()), Matrix::Identity() * rI_);
   }
 
- protected:
-  /// Covariance matrix.
-  const Eigen::Matrix<T, WN, WN> q_;
-
-  /// State vector.
-  Eigen::Matrix<T, N, 1> x_;
-  /// Process noise.
-  Eigen::Matrix<T, N, N> p_;
-};
-
-  
-
-/**
- Kalman filter fusing orientation measurements.
-
- @tparam T Datatype used by the filter.
- */
-template<typename T>
-class EKFOrientation : public KalmanFilter<T, 10, 10> {
- private:
   /**
-   Shared state update function.
-   */
-  struct EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 10, 1> Update(
-        const Eigen::Matrix<S, 10, 1> &x,
-        const Eigen::Matrix<S, 10, 1> &w,
-        const S &dt)
-    {
-      // Extract rotation data from the state.
-      Eigen::Quaternion<S> rq(x(3), x(0), x(1), x(2));
-      Eigen::Matrix<S, 3, 1> rv(x(4), x(5), x(6));
-      Eigen::Matrix<S, 3, 1> ra(x(7), x(8), x(9));
-
-      // Normalize if necessary.
-      if (rq.norm() > S(1e-6)) {
-        rq.normalize();
-      }
-
-      // Update the angular velocity and the rotation.
-      Eigen::Matrix<S, 3, 1> r = S(0.5) * (rv * dt + ra * dt * dt / S(2));
-      rv = rv + ra * dt;
-      rq = Eigen::Quaternion<S>(S(0), r(0), r(1), r(2)) * rq;
-
-      // Repack data into the state vector.
-      return (Eigen::Matrix<S, 10, 1>() <<
-          x(0) + rq.x(),
-          x(1) + rq.y(),
-          x(2) + rq.z(),
-          x(3) + rq.w(),
-          rv(0), rv(1), rv(2),
-          ra(0), ra(1), ra(2)
-      ).finished() + w;
-    }
-  };
+   Corrects the state with a pose measured by the tracker.
 
-  /**
-   State update & measurement function for a sensor measurement.
+   @param q Orientation of the camera.
+   @param t Translation of the view transform.
    */
-  struct EKFSensorUpdate : public EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 7, 1> Measure(
-        const Eigen::Matrix<S, 10, 1> &x,
-        const Eigen::Matrix<S, 7, 1> &w)
-    {
-      Eigen::Quaternion<S> rq(x(3), x(0), x(1), x(2));
-      if (rq.norm() > S(1e-6)) {
-        rq.normalize();
-      }
-      return (Eigen::Matrix<S, 7, 1>() <<
-          rq.x(), rq.y(), rq.z(), rq.w(),
-          x(4), x(5), x(6)
-      ).finished() + w;
-    }
-  };
+  void CorrectPose(const Quaternion &q, const Vector &t) {
+    const Vector p = -(q.inverse() * t);
 
-  /**
-   State update & measurement function for a marker measurement.
-   */
-  struct EKFMarkerUpdate : public EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 4, 1> Measure(
-        const Eigen::Matrix<S, 10, 1> &x,
-        const Eigen::Matrix<S, 4, 1> &w)
-    {
-      Eigen::Quaternion<S> rq(x(3), x(0), x(1), x(2));
-      if (rq.norm() > S(1e-6)) {
-        rq.normalize();
-      }
-      return (Eigen::Matrix<S, 4, 1>() <<
-          rq.x(), rq.y(), rq.z(), rq.w()
-      ).finished() + w;
+    if (!hasAttitude_) {
+      q_ = q.normalized();
+      hasAttitude_ = true;
+    }
+    if (!hasPosition_) {
+      p_ = p;
+      v_.setZero();
+      hasPosition_ = true;
+      return;
     }
-  };
 
- public:
+    Eigen::Matrix<T, 6, 1> y;
+    y << p - p_, Log(q * q_.inverse());
+    Eigen::Matrix<T, 6, 6> r = Eigen::Matrix<T, 6, 6>::Zero();
+    r.diagonal() << rMp_, rMp_, rMp_, rMq_, rMq_, rMq_;
+    Correct<2>({ kP, kTheta }, y, r);
+  }
+
   /**
-   Creates the Kalman filter.
+   Returns true if the position was initialized by a pose.
    */
-  EKFOrientation()
-    : KalmanFilter<T, 10, 10>(
-        (Eigen::Matrix<T, 10, 1>() <<
-          5e-2, 5e-2, 5e-2, 5e-2, 1e-4, 1e-4, 1e-4, 1e-4, 1e-4, 1e-4
-        ).finished().asDiagonal(),
-        (Eigen::Matrix<T, 10, 1>() <<
-          0, 1, 0, 0, 0, 0, 0, 0, 0, 0
-        ).finished(),
-        (Eigen::Matrix<T, 10, 1>() <<
-          10, 10, 10, 10, 10, 10, 10, 10, 10, 10
-        ).finished().asDiagonal()
-      )
-  {
-    // Marker measurement noise.
-    Eigen::Matrix<T, 4, 1> rM;
-    rM << 1e-2, 1e-2, 1e-2, 1e-2;
-    rM_ = rM.asDiagonal();
-
-    // IMU measurement noise.
-    Eigen::Matrix<T, 7, 1> rI;
-    rI << 1e-3, 1e-3, 1e-3, 1e-3, 1e-2, 1e-2, 1e-2;
-    rI_ = rI.asDiagonal();
+  bool HasPosition() const {
+    return hasPosition_;
   }
 
   /**
-   Updates the filter with a measurement from the tracker.
+   Returns the orientation.
    */
-  void UpdateMarker(
-      const Eigen::Quaternion<T> &q,
-      const T &dt)
-  {
-    KalmanFilter<T, 10, 10>::template Update<EKFMarkerUpdate, 4, 4>(dt, (
-        Eigen::Matrix<T, 4, 1>() << q.x(), q.y(), q.z(), q.w()
-    ).finished(), rM_);
+  Quaternion GetOrientation() const {
+    return q_;
   }
 
   /**
-   Updates the filter with a measurement from the IMU.
+   Returns the position of the camera in the world frame.
    */
-  void UpdateIMU(
-      const Eigen::Quaternion<T> &q,
-      const Eigen::Matrix<T, 3, 1> &w,
-      const T &dt)
-  {
-    KalmanFilter<T, 10, 10>::template Update<EKFSensorUpdate, 7, 7>(dt, (
-        Eigen::Matrix<T, 7, 1>() << q.x(), q.y(), q.z(), q.w(), w(0), w(1), w(2)
-    ).finished(), rI_);
+  Vector GetPosition() const {
+    return p_;
   }
 
   /**
-   Returns the orientation.
+   Returns the translation of the view transform.
    */
-  Eigen::Quaternion<T> GetOrientation() const {
-    const auto &x = KalmanFilter<T, 10, 10>::x_;
-    return Eigen::Quaternion<T>(x(3), x(0), x(1), x(2)).normalized();
+  Vector GetTranslation() const {
+    return -(q_ * p_);
   }
 
  private:
-  /// Measurement noise for tracker.
-  Eigen::Matrix<T, 4, 4> rM_;
-  /// Measurement noise for IMU.
-  Eigen::Matrix<T, 7, 7> rI_;
-};
-  
-  
-  
-/**
- Kalman filter for position measurements
- */
-template<typename T>
-class EKFPosition : public KalmanFilter<T, 9, 9> {
- private:
-  /**
-   Shared state update function.
-   */
-  struct EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 9, 1> Update(
-        const Eigen::Matrix<S, 9, 1> &x,
-        const Eigen::Matrix<S, 9, 1> &w,
-        const S &dt)
-    {
-      // Extract position data from the state.
-      Eigen::Matrix<S, 3, 1> px(x(0), x(1), x(2));
-      Eigen::Matrix<S, 3, 1> pv(x(3), x(4), x(5));
-      Eigen::Matrix<S, 3, 1> pa(x(6), x(7), x(8));
-      
-      // Update the position and velocity.
-      px = px + pv * dt + pa * dt * dt * S(0.5);
-      pv = pv + pa * dt;
-      
-      // Repack data into the state vector.
-      return (Eigen::Matrix<S, 9, 1>() << px, pv, pa).finished() + w;
-    }
-  };
-  
+  /// Offsets of the blocks in the error state.
+  static constexpr int kP = 0;
+  static constexpr int kV = 3;
+  static constexpr int kTheta = 6;
+  static constexpr int kBG = 9;
+  static constexpr int kBA = 12;
+
   /**
-   State update & measurement function for a sensor measurement.
+   Corrects the state with a measurement of some of the 3-dimensional blocks.
+   The measurement Jacobian is the identity on those blocks, so the products
+   with it reduce to selecting rows and columns of the covariance.
+
+   @param blocks Offsets of the measured blocks.
+   @param y      Residual between the measurement and the state.
+   @param r      Measurement noise.
    */
-  struct EKFSensorUpdate : public EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 3, 1> Measure(
-        const Eigen::Matrix<S, 9, 1> &x,
-        const Eigen::Matrix<S, 3, 1> &w)
-    {
-      Eigen::Matrix<S, 3, 1> px(x(6), x(7), x(8));
-      return px + w;
+  template<size_t M>
+  void Correct(
+      const std::array<int, M> &blocks,
+      const Eigen::Matrix<T, 3 * M, 1> &y,
+      const Eigen::Matrix<T, 3 * M, 3 * M> &r)
+  {
+    // P * H^T and S = H * P * H^T + R.
+    Eigen::Matrix<T, kStates, 3 * M> ph;
+    for (size_t i = 0; i < M; ++i) {
+      ph.template middleCols<3>(3 * i) = cov_.template middleCols<3>(blocks[i]);
     }
-  };
-  
-  /**
-   State update & measurement function for a marker measurement.
-   */
-  struct EKFMarkerUpdate : public EKFUpdate {
-    template<typename S>
-    static Eigen::Matrix<S, 3, 1> Measure(
-        const Eigen::Matrix<S, 9, 1> &x,
-        const Eigen::Matrix<S, 3, 1> &w)
-    {
-      Eigen::Matrix<S, 3, 1> px(x(0), x(1), x(2));
-      return px + w;
+    Eigen::Matrix<T, 3 * M, 3 * M> s = r;
+    for (size_t i = 0; i < M; ++i) {
+      s.template middleRows<3>(3 * i) += ph.template middleRows<3>(blocks[i]);
     }
-  };
 
- public:
-  /**
-   Creates the Kalman filter.
-   */
-  EKFPosition()
-    : KalmanFilter<T, 9, 9>(
-        (Eigen::Matrix<T, 9, 1>() <<
-           5e-2, 5e-2, 5e-2, 1e-0, 1e-0, 1e-0, 5e-1, 5e-1, 5e-1
-        ).finished().asDiagonal(),
-        (Eigen::Matrix<T, 9, 1>() <<
-           0, 0, 0, 0, 0, 0, 0, 0, 0
-        ).finished(),
-        (Eigen::Matrix<T, 9, 1>() <<
-          10, 10, 10, 10, 10, 10, 10, 10, 10
-        ).finished().asDiagonal()
-      )
-  {
-    rM_ <<
-      1e-0,    0,    0,
-         0, 1e-0,    0,
-         0,    0, 1e-0;
-    rI_ <<
-      5e-1,    0,    0,
-         0, 5e-1,    0,
-         0,    0, 5e-1;
+    // K = P * H^T * S^-1, solving instead of inverting S.
+    const Eigen::Matrix<T, kStates, 3 * M> k = s.ldlt().solve(ph.transpose()).transpose();
+    const Eigen::Matrix<T, kStates, 1> dx = k * y;
+    cov_ -= k * ph.transpose();
+    cov_ = (cov_ + cov_.transpose()) * T(0.5);
+
+    // Inject the error into the nominal state.
+    p_ += dx.template segment<3>(kP);
+    v_ += dx.template segment<3>(kV);
+    q_ = (Exp(dx.template segment<3>(kTheta)) * q_).normalized();
+    bg_ += dx.template segment<3>(kBG);
+    ba_ += dx.template segment<3>(kBA);
   }
 
   /**
-   Updates the filter with a marker pose estimate.
+   Returns the cross product matrix of a vector.
    */
-  void UpdateMarker(const Eigen::Matrix<T, 3, 1> &x, const T& dt) {
-    KalmanFilter<T, 9, 9>::template Update<EKFMarkerUpdate, 3, 3>(dt, x, rM_);
+  static Matrix Skew(const Vector &v) {
+    Matrix m;
+    m <<
+         T(0), -v.z(),  v.y(),
+         v.z(),  T(0), -v.x(),
+        -v.y(),  v.x(),  T(0);
+    return m;
   }
-  
+
   /**
-   Updates the filter with an IMU pose estimate.
+   Converts a rotation vector to a quaternion.
    */
-  void UpdateIMU(const Eigen::Matrix<T, 3, 1> &a, const T& dt) {
-    KalmanFilter<T, 9, 9>::template Update<EKFSensorUpdate, 3, 3>(dt, a, rI_);
+  static Quaternion Exp(const Vector &v) {
+    const T angle = v.norm();
+    if (angle < T(1e-6)) {
+      return Quaternion(T(1), v.x() / T(2), v.y() / T(2), v.z() / T(2)).normalized();
+    }
+    const Vector axis = v / angle * std::sin(angle / T(2));
+    return Quaternion(std::cos(angle / T(2)), axis.x(), axis.y(), axis.z());
   }
-  
+
   /**
-   Returns the position.
+   Converts a quaternion to a rotation vector, taking the shorter rotation.
    */
-  Eigen::Matrix<T, 3, 1> GetPosition() const {
-    const auto &x = KalmanFilter<T, 9, 9>::x_;
-    return Eigen::Matrix<T, 3, 1>(x(0), x(1), x(2));
+  static Vector Log(const Quaternion &q) {
+    const T sign = q.w() < T(0) ? T(-1) : T(1);
+    const Vector v = sign * q.vec();
+    const T norm = v.norm();
+    if (norm < T(1e-6)) {
+      return T(2) * v;
+    }
+    return v / norm * (T(2) * std::atan2(norm, sign * q.w()));
   }
-  
+
  private:
-  /// Measurement noise for tracker.
-  Eigen::Matrix<T, 3, 3> rM_;
-  /// Measurement noise for IMU.
-  Eigen::Matrix<T, 3, 3> rI_;
+  /// Position of the camera.
+  Vector p_;
+  /// Velocity of the camera.
+  Vector v_;
+  /// Orientation of the camera.
+  Quaternion q_;
+  /// Gyroscope bias.
+  Vector bg_;
+  /// Accelerometer bias.
+  Vector ba_;
+  /// Covariance of the error state.
+  Eigen::Matrix<T, kStates, kStates> cov_;
+
+  /// True if the orientation was initialized from a measurement.
+  bool hasAttitude_;
+  /// True if the position was initialized from a measurement.
+  bool hasPosition_;
+
+  /// Process noise of the gyroscope and the accelerometer.
+  T qw_;
+  T qa_;
+  /// Random walk of the gyroscope and accelerometer biases.
+  T qbg_;
+  T qba_;
+  /// Measurement noise of IMU attitudes.
+  T rI_;
+  /// Measurement noise of marker attitudes and positions.
+  T rMq_;
+  T rMp_;
 };
-  
+
 }
@@ -0,0 +1,128 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <cstring>
+#include <fstream>
+
+#include "ar/LightCache.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Identifies light files.
+constexpr uint32_t kMagic = 0x534C5241;
+/// Version of the file format, to be bumped when samplers change.
+constexpr uint32_t kVersion = 1;
+
+/**
+ Serialized light source.
+ */
+struct LightRecord {
+  float direction[3];
+  float ambient[3];
+  float diffuse[3];
+  float specular[3];
+  int32_t region[4];
+  int32_t centroidY;
+  int32_t centroidX;
+  float area;
+};
+
+}
+
+
+LightCache::LightCache(
+    const std::string &path,
+    Method method,
+    size_t depth,
+    const cv::Mat &image)
+  : path_(path)
+{
+  header_.magic = kMagic;
+  header_.version = kVersion;
+  header_.method = method;
+  header_.depth = static_cast<uint32_t>(depth);
+  header_.rows = image.rows;
+  header_.cols = image.cols;
+  header_.hash = hash(image);
+  header_.count = 1ull << depth;
+}
+
+
+bool LightCache::read(std::vector<LightSource> &lights) const {
+  std::ifstream is(path_, std::ios::binary);
+  if (!is) {
+    return false;
+  }
+
+  // Ensure the file was produced from the same image and parameters.
+  Header header;
+  if (!is.read(reinterpret_cast<char*>(&header), sizeof(Header))) {
+    return false;
+  }
+  if (std::memcmp(&header, &header_, sizeof(Header)) != 0) {
+    return false;
+  }
+
+  std::vector<LightRecord> records(header.count);
+  if (!is.read(reinterpret_cast<char*>(records.data()), sizeof(LightRecord) * records.size())) {
+    return false;
+  }
+
+  lights.clear();
+  for (const auto &r : records) {
+    lights.push_back({
+        { r.direction[0], r.direction[1], r.direction[2] },
+        { r.ambient[0], r.ambient[1], r.ambient[2] },
+        { r.diffuse[0], r.diffuse[1], r.diffuse[2] },
+        { r.specular[0], r.specular[1], r.specular[2] },
+        Region(r.region[0], r.region[1], r.region[2], r.region[3]),
+        r.centroidY,
+        r.centroidX,
+        r.area
+    });
+  }
+  return true;
+}
+
+
+void LightCache::write(const std::vector<LightSource> &lights) const {
+  assert(lights.size() == header_.count);
+
+  std::vector<LightRecord> records;
+  for (const auto &l : lights) {
+    records.push_back({
+        { l.direction.x(), l.direction.y(), l.direction.z() },
+        { l.ambient.x(), l.ambient.y(), l.ambient.z() },
+        { l.diffuse.x(), l.diffuse.y(), l.diffuse.z() },
+        { l.specular.x(), l.specular.y(), l.specular.z() },
+        { l.region.y0, l.region.x0, l.region.y1, l.region.x1 },
+        l.centroidY,
+        l.centroidX,
+        l.area
+    });
+  }
+
+  // Failing to write the cache is not fatal, lights are resampled next time.
+  std::ofstream os(path_, std::ios::binary | std::ios::trunc);
+  os.write(reinterpret_cast<const char*>(&header_), sizeof(Header));
+  os.write(reinterpret_cast<const char*>(records.data()), sizeof(LightRecord) * records.size());
+}
+
+
+uint64_t LightCache::hash(const cv::Mat &image) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  const size_t bytes = image.cols * image.elemSize();
+  for (int r = 0; r < image.rows; ++r) {
+    const auto row = image.ptr<uint8_t>(r);
+    for (size_t i = 0; i < bytes; ++i) {
+      h = (h ^ row[i]) * 0x100000001b3ull;
+    }
+  }
+  return h;
+}
+
+}
@@ -0,0 +1,82 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ar/LightProbeSampler.h"
+
+
+namespace ar {
+
+/**
+ Stores the output of a light probe sampler in a file.
+ 
+ Along with the lights, the file records the sampling method, the depth and
+ a hash of the source image, so stale files are detected on load.
+ */
+class LightCache {
+ public:
+  /**
+   Sampling methods.
+   */
+  enum Method {
+    MEDIAN_CUT = 1,
+    VARIANCE_CUT = 2
+  };
+
+  /**
+   Creates a cache entry for an image sampled with a given method.
+   */
+  LightCache(
+      const std::string &path,
+      Method method,
+      size_t depth,
+      const cv::Mat &image);
+
+  /**
+   Reads the lights if the file matches the parameters.
+   
+   @return True if the lights were read.
+   */
+  bool read(std::vector<LightSource> &lights) const;
+
+  /**
+   Writes the lights, along with the parameters.
+   */
+  void write(const std::vector<LightSource> &lights) const;
+
+ private:
+  /**
+   Header identifying a sampling run.
+   */
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t method;
+    uint32_t depth;
+    int32_t rows;
+    int32_t cols;
+    uint64_t hash;
+    uint64_t count;
+  };
+
+  /**
+   Computes a 64 bit FNV-1a hash of the pixels.
+   */
+  static uint64_t hash(const cv::Mat &image);
+
+ private:
+  /// Path to the file.
+  const std::string path_;
+  /// Expected header.
+  Header header_;
+};
+
+}
@@ -3,64 +3,69 @@
 // (C) 2015 Nandor Licker. All rights reserved.
 
 #include "LightProbeSampler.h"
+#include "Parallel.h"
 
 namespace ar {
 
+namespace {
+
+/**
+ Weights a row of RGB(A) pixels and computes their luminance.
+ */
+template<typename T>
+void ConvertRow(
+    const T *src,
+    int chan,
+    float w,
+    cv::Mat &image,
+    cv::Mat &illum,
+    int r)
+{
+  auto pj = image.ptr<cv::Vec3f>(r);
+  auto pl = illum.ptr<float>(r);
+  for (int c = 0; c < image.cols; ++c, src += chan) {
+    const float red = src[0] * w;
+    const float green = src[1] * w;
+    const float blue = src[2] * w;
+    pj[c] = cv::Vec3f(red, green, blue);
+    pl[c] = blue * 0.0721 + green * 0.7154 + red * 0.2125;
+  }
+}
+
+}
+
 
 LightProbeSampler::LightProbeSampler(size_t depth, const cv::Mat &image)
   : depth_(depth)
   , count_(1 << depth_)
   , height_(image.rows)
-  , image_(image.rows, image.cols, CV_32FC4)
+  , image_(image.rows, image.cols, CV_32FC3)
   , illum_(image.rows, image.cols, CV_32FC1)
 {
-  cv::Mat floatImage;
-  switch (image.type()) {
-    case CV_32FC4: {
-      floatImage = image;
-      break;
-    }
-    case CV_32FC3: {
-      cv::cvtColor(image, floatImage, CV_BGR2BGRA);
-      break;
-    }
-    case CV_8UC3: {
-      image.convertTo(floatImage, CV_32FC3);
-      floatImage /= 255.0f;
-      cv::cvtColor(floatImage, floatImage, CV_BGR2BGRA);
-      break;
-    }
-    case CV_8UC4: {
-      image.convertTo(floatImage, CV_32FC4);
-      floatImage /= 255.0f;
-      break;
-    }
+  const int chan = image.channels();
+  if (chan != 3 && chan != 4) {
+    throw std::runtime_error("Image must be either RGB or RGBA.");
   }
-
-  // Scale the pixels to compensate for over-representation.
-  for (int r = 0; r < image_.rows; ++r) {
-    const auto pi = floatImage.ptr<cv::Vec4f>(r);
-    auto pj = image_.ptr<cv::Vec4f>(r);
-
-    // Compensate by cos(phi).
-    const float w = std::cos(r / height_ * M_PI - M_PI / 2.0f);
-
-    for (int c = 0; c < image_.cols; ++c) {
-      const auto &pix = pi[c];
-      pj[c] = cv::Vec4f(pix[0] * w, pix[1] * w, pix[2] * w, pix[3]);
-    }
+  if (image.depth() != CV_8U && image.depth() != CV_32F) {
+    throw std::runtime_error("Image must be 8 bit or floating point.");
   }
 
-  // Compute the luminance map.
-  for (int r = 0; r < image_.rows; ++r) {
-    const auto pi = image_.ptr<cv::Vec4f>(r);
-    auto pl = illum_.ptr<float>(r);
+  // Weights compensating for the over-representation of the poles, with the
+  // scale of 8 bit images folded in.
+  const float scale = image.depth() == CV_8U ? 1.0f / 255.0f : 1.0f;
+  std::vector<float> weights(image.rows);
+  for (int r = 0; r < image.rows; ++r) {
+    weights[r] = std::cos(r / height_ * M_PI - M_PI / 2.0f) * scale;
+  }
 
-    for (int c = 0; c < image_.cols; ++c) {
-      const auto &pix = pi[c];
-      pl[c] = pix[2] * 0.0721 + pix[1] * 0.7154 + pix[0] * 0.2125;
+  // Convert, weight and compute the luminance map in a single pass.
+  ParallelFor(0, image.rows, [&](int r) {
+    if (image.depth() == CV_8U) {
+      ConvertRow(image.ptr<uint8_t>(r), chan, weights[r], image_, illum_, r);
+    } else {
+      ConvertRow(image.ptr<float>(r), chan, weights[r], image_, illum_, r);
     }
-  }
+  });
 }
 
 
@@ -69,10 +74,50 @@ LightProbeSampler::~LightProbeSampler() {
 
 
 std::vector<LightSource> LightProbeSampler::operator() () {
-  if (lights_.empty()) {
+  return (*this)(depth_);
+}
+
+
+std::vector<LightSource> LightProbeSampler::operator() (size_t depth) {
+  // Build the tree on the first query.
+  tree();
+
+  std::vector<LightSource> lights;
+  lights.reserve(1 << std::min(depth, depth_));
+  collect(0, depth, lights);
+  return lights;
+}
+
+
+const std::vector<LightNode> &LightProbeSampler::tree() {
+  if (tree_.empty()) {
+    tree_.reserve((count_ << 1) - 1);
     split({ 0, 0, illum_.rows - 1, illum_.cols - 1 }, 0);
   }
-  return lights_;
+  return tree_;
+}
+
+
+int LightProbeSampler::insert(const Region &region, int depth, int y, int x) {
+  tree_.push_back({ sample(region, y, x), static_cast<size_t>(depth), -1, -1 });
+  return static_cast<int>(tree_.size() - 1);
+}
+
+
+void LightProbeSampler::collect(
+    int node,
+    size_t depth,
+    std::vector<LightSource> &lights) const
+{
+  // Stop at leaves or at the requested depth, otherwise recurse in order
+  // to keep lights sorted the same way at all depths.
+  const auto &n = tree_[node];
+  if (n.depth >= depth || n.left < 0) {
+    lights.push_back(n.light);
+    return;
+  }
+  collect(n.left, depth, lights);
+  collect(n.right, depth, lights);
 }
 
 
@@ -86,7 +131,7 @@ LightSource LightProbeSampler::sample(const Region &region, int y, int x) const
   // to its distance from the cenroid.
   double sumB = 0.0f, sumG = 0.0f, sumR = 0.0f, sumW = 0.0f;
   for (int r = region.y0; r <= region.y1; ++r) {
-    const auto &row = image_.ptr<cv::Vec4f>(r);
+    const auto &row = image_.ptr<cv::Vec3f>(r);
     for (int c = region.x0; c <= region.x1; ++c) {
 
       // Compute distance from centroid.
@@ -128,22 +173,22 @@ LightSource LightProbeSampler::sample(const Region &region, int y, int x) const
 
   // Create the light source.
   return {
-    simd::float3{
+    LightVector{
       -vx,
       -vy,
       -vz
     },
-    simd::float3{
+    LightVector{
       0.0f, // r / 5.0f,
       0.0f, // g / 5.0f,
       0.0f, // b / 5.0f
     },
-    simd::float3{
+    LightVector{
       r,
       g,
       b
     },
-    simd::float3{
+    LightVector{
       r,
       g,
       b,
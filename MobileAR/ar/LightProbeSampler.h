@@ -6,7 +6,7 @@
 
 #include <vector>
 
-#include <simd/simd.h>
+#include <Eigen/Eigen>
 
 #include <opencv2/opencv.hpp>
 
@@ -15,18 +15,26 @@
 
 namespace ar {
 
+/**
+ Vector used by light sources.
+ 
+ Kept independent of platform specific vector libraries, conversion to the
+ types used by the renderer is done by the Objective-C++ wrappers.
+ */
+typedef Eigen::Vector3f LightVector;
+
 /**
  Light source info.
  */
 struct LightSource {
   /// Direction of the light source.
-  const simd::float3 direction;
+  const LightVector direction;
   /// Ambient intensity.
-  const simd::float3 ambient;
+  const LightVector ambient;
   /// Diffuse intensity.
-  const simd::float3 diffuse;
+  const LightVector diffuse;
   /// Specular intensity.
-  const simd::float3 specular;
+  const LightVector specular;
   /// Region of the light source.
   const Region region;
   /// Y coordinate of centroid.
@@ -37,6 +45,20 @@ struct LightSource {
   const float area;
 };
 
+/**
+ Node of the cut tree, aggregating all the light in its region.
+ */
+struct LightNode {
+  /// Light source representing the whole region.
+  const LightSource light;
+  /// Depth of the node.
+  const size_t depth;
+  /// Index of the first child, -1 for leaves.
+  int left;
+  /// Index of the second child, -1 for leaves.
+  int right;
+};
+
 /**
  * Class that implements median cut sampling.
  */
@@ -53,21 +75,50 @@ class LightProbeSampler {
   virtual ~LightProbeSampler();
 
   /**
-   Performs the sampling.
+   Performs the sampling, returning the lights at the maximal depth.
    */
   std::vector<LightSource> operator() ();
+
+  /**
+   Returns the lights at a given depth, without accessing the image.
+   
+   The cut tree is built on the first call, so any depth up to the
+   maximal one can be queried in O(2^depth).
+   */
+  std::vector<LightSource> operator() (size_t depth);
+
+  /**
+   Returns the cut tree, with the root at index 0.
+   
+   Children can be expanded one by one in order to refine lights progressively.
+   */
+  const std::vector<LightNode> &tree();
   
 protected:
   /**
    * Splits the image vertically or horizontally into two and recurses.
+   *
+   * @return Index of the node covering the region.
    */
-  virtual void split(const Region &region, int depth) = 0;
+  virtual int split(const Region &region, int depth) = 0;
   
   /**
    Creates a light source out of a region.
    */
   LightSource sample(const Region &region, int y, int x) const;
 
+  /**
+   Adds a node to the tree for a region with a given centroid.
+   
+   @return Index of the node.
+   */
+  int insert(const Region &region, int depth, int y, int x);
+
+  /**
+   Collects the lights at a given depth from a subtree.
+   */
+  void collect(int node, size_t depth, std::vector<LightSource> &lights) const;
+
   /**
    Computes the width of a region.
    */
@@ -85,12 +136,12 @@ protected:
   const size_t count_;
   /// Height of the image.
   const float height_;
-  /// Image to be sampled.
+  /// Image to be sampled, RGB weighted by cos(phi).
   cv::Mat image_;
   /// Luminance map.
   cv::Mat illum_;
-  /// Output light sources.
-  std::vector<LightSource> lights_;
+  /// Cut tree, with nodes stored in pre-order.
+  std::vector<LightNode> tree_;
 };
 
 }
\ No newline at end of file
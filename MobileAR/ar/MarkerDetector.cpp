@@ -0,0 +1,110 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "ar/MarkerDetector.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Smallest side of a marker that can still be decoded, in pixels.
+constexpr float kMinMarkerSide = 32.0f;
+/// Largest downscaling factor.
+constexpr float kMaxScale = 4.0f;
+/// Downscaling factors below this are not worth it.
+constexpr float kMinScale = 1.25f;
+
+
+/**
+ Returns the length of the shortest side of a marker.
+ */
+float MinSide(const cv::Point2f *marker, size_t count) {
+  float side = std::numeric_limits<float>::max();
+  for (size_t i = 0; i < count; ++i) {
+    const auto &p = marker[i];
+    const auto &q = marker[(i + 1) % count];
+    side = std::min(side, std::sqrt((p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y)));
+  }
+  return side;
+}
+
+}
+
+
+MarkerDetector::MarkerDetector(
+    const cv::Ptr<cv::aruco::Dictionary> &dict,
+    const cv::Ptr<cv::aruco::DetectorParameters> &params)
+  : dict_(dict)
+  , params_(params)
+{
+}
+
+
+void MarkerDetector::operator() (
+    const cv::Mat &gray,
+    float scale,
+    std::vector<std::vector<cv::Point2f>> &corners,
+    std::vector<int> &ids)
+{
+  const cv::Size size(
+      static_cast<int>(gray.cols / scale),
+      static_cast<int>(gray.rows / scale)
+  );
+  if (scale < kMinScale || size.width <= 0 || size.height <= 0) {
+    cv::aruco::detectMarkers(gray, dict_, corners, ids, params_);
+    return;
+  }
+
+  // Find candidates on the downscaled image.
+  cv::resize(gray, scaled_, size, 0, 0, cv::INTER_AREA);
+  cv::aruco::detectMarkers(scaled_, dict_, corners, ids, params_);
+
+  // Map the corners to the full image, taking into account that pixel
+  // centres are offset, and refine them in a window covering the error.
+  const float sx = static_cast<float>(gray.cols) / size.width;
+  const float sy = static_cast<float>(gray.rows) / size.height;
+  for (auto &marker : corners) {
+    for (auto &p : marker) {
+      p.x = (p.x + 0.5f) * sx - 0.5f;
+      p.y = (p.y + 0.5f) * sy - 0.5f;
+    }
+
+    const int win = std::max(2, std::min(
+        static_cast<int>(std::ceil(std::max(sx, sy))) + 1,
+        static_cast<int>(MinSide(marker.data(), marker.size()) / 4)
+    ));
+    cv::cornerSubPix(
+        gray,
+        marker,
+        { win, win },
+        { -1, -1 },
+        { cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 0.01 }
+    );
+  }
+}
+
+
+float MarkerDetector::Scale(const std::vector<std::vector<cv::Point2f>> &corners) {
+  if (corners.empty()) {
+    return 1.0f;
+  }
+
+  float side = std::numeric_limits<float>::max();
+  for (const auto &marker : corners) {
+    side = std::min(side, MinSide(marker.data(), marker.size()));
+  }
+  return std::max(1.0f, std::min(kMaxScale, side / kMinMarkerSide));
+}
+
+
+float MarkerDetector::Scale(const cv::Point2f *marker, size_t count) {
+  return std::max(1.0f, std::min(kMaxScale, MinSide(marker, count) / kMinMarkerSide));
+}
+
+}
@@ -0,0 +1,61 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Coarse-to-fine ArUco marker detector.
+
+ Candidates are found on a downscaled image, where thresholding and contour
+ extraction are cheaper. Corners are then refined at full resolution.
+ */
+class MarkerDetector {
+ public:
+  /**
+   Creates a new detector.
+   */
+  MarkerDetector(
+      const cv::Ptr<cv::aruco::Dictionary> &dict,
+      const cv::Ptr<cv::aruco::DetectorParameters> &params);
+
+  /**
+   Detects markers in a grayscale image.
+
+   @param scale Factor the image is downscaled by to find candidates.
+   */
+  void operator() (
+      const cv::Mat &gray,
+      float scale,
+      std::vector<std::vector<cv::Point2f>> &corners,
+      std::vector<int> &ids);
+
+  /**
+   Picks the downscaling factor for markers of a size similar to the given
+   ones, such that the smallest of them can still be decoded.
+   */
+  static float Scale(const std::vector<std::vector<cv::Point2f>> &corners);
+
+  /**
+   Picks the downscaling factor for a single marker, given its corners.
+   */
+  static float Scale(const cv::Point2f *marker, size_t count);
+
+ private:
+  /// ArUco dictionary.
+  cv::Ptr<cv::aruco::Dictionary> dict_;
+  /// ArUco detector config.
+  cv::Ptr<cv::aruco::DetectorParameters> params_;
+  /// Downscaled image.
+  cv::Mat scaled_;
+};
+
+}
@@ -0,0 +1,259 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include "ar/MarkerResiduals.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Maximum scene size.
+constexpr double kMaxDistance = 1000.0;
+
+/// Row-major maps of the Jacobian blocks.
+typedef Eigen::Map<Eigen::Matrix<double, 8, 3, Eigen::RowMajor>> JacobianT;
+typedef Eigen::Map<Eigen::Matrix<double, 8, 4, Eigen::RowMajor>> JacobianQ;
+
+
+/**
+ Derivative of R(q) * v with respect to the coefficients (x, y, z, w) of q.
+ */
+Eigen::Matrix<double, 3, 4> RotationJacobian(
+    const Eigen::Quaternion<double> &q,
+    const Eigen::Matrix<double, 3, 1> &v)
+{
+  const double x = q.x(), y = q.y(), z = q.z(), w = q.w();
+  const double a = v.x(), b = v.y(), c = v.z();
+
+  Eigen::Matrix<double, 3, 4> J;
+  J <<
+      2 * (y * b + z * c),
+      2 * (x * b + w * c) - 4 * y * a,
+      2 * (x * c - w * b) - 4 * z * a,
+      2 * (y * c - z * b),
+
+      2 * (y * a - w * c) - 4 * x * b,
+      2 * (x * a + z * c),
+      2 * (w * a + y * c) - 4 * z * b,
+      2 * (z * a - x * c),
+
+      2 * (z * a + w * b) - 4 * x * c,
+      2 * (z * b - w * a) - 4 * y * c,
+      2 * (x * a + y * b),
+      2 * (x * b - y * a);
+  return J;
+}
+
+
+/**
+ Divides by depth, writing the residual and returning the derivative of the
+ pixel with respect to the homogeneous point.
+ */
+Eigen::Matrix<double, 2, 3> Project(
+    const Eigen::Matrix<double, 3, 1> &x,
+    const Eigen::Matrix<double, 2, 1> &corner,
+    double *r)
+{
+  const double iz = 1.0 / x.z();
+  const double u = x.x() * iz;
+  const double v = x.y() * iz;
+  r[0] = u - corner.x();
+  r[1] = v - corner.y();
+
+  Eigen::Matrix<double, 2, 3> J;
+  J <<
+      iz, 0.0, -u * iz,
+      0.0, iz, -v * iz;
+  return J;
+}
+
+
+/**
+ Copies the four corners of a marker.
+ */
+template<typename T, typename U>
+void CopyCorners(const std::vector<T> &from, std::array<U, 4> &to) {
+  assert(from.size() == 4);
+  for (size_t i = 0; i < 4; ++i) {
+    to[i] = { from[i].x, from[i].y };
+  }
+}
+
+}
+
+
+MarkerResidual::MarkerResidual(
+    const Eigen::Matrix<double, 4, 4> &k,
+    const Eigen::Matrix<double, 3, 1> &t,
+    const Eigen::Quaternion<double> &q,
+    const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+    const std::vector<cv::Point2f> &corners)
+  : kr_(k.block<3, 3>(0, 0) * q.toRotationMatrix())
+  , kt_(k.block<3, 3>(0, 0) * t)
+{
+  assert(grid.size() == 4);
+  std::copy(grid.begin(), grid.end(), grid_.begin());
+  CopyCorners(corners, corners_);
+}
+
+
+bool MarkerResidual::Evaluate(
+    double const *const *params,
+    double *r,
+    double **J) const
+{
+  const Eigen::Map<const Eigen::Matrix<double, 3, 1>> mt(params[0]);
+  const Eigen::Map<const Eigen::Quaternion<double>> mq(params[1]);
+  if (mt.norm() > kMaxDistance) {
+    return false;
+  }
+
+  const Eigen::Matrix<double, 3, 3> mr = mq.toRotationMatrix();
+  for (size_t i = 0; i < 4; ++i) {
+    const Eigen::Matrix<double, 3, 1> x = kr_ * (mr * grid_[i] + mt) + kt_;
+    const Eigen::Matrix<double, 2, 3> dx = Project(x, corners_[i], r + i * 2);
+    if (!J) {
+      continue;
+    }
+
+    const Eigen::Matrix<double, 2, 3> dmt = dx * kr_;
+    if (J[0]) {
+      JacobianT(J[0]).block<2, 3>(i * 2, 0) = dmt;
+    }
+    if (J[1]) {
+      JacobianQ(J[1]).block<2, 4>(i * 2, 0) = dmt * RotationJacobian(mq, grid_[i]);
+    }
+  }
+  return true;
+}
+
+
+MarkerPoseResidual::MarkerPoseResidual(
+    const Eigen::Matrix<double, 4, 4> &k,
+    const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+    const std::vector<cv::Point2f> &corners)
+  : k_(k.block<3, 3>(0, 0))
+{
+  assert(grid.size() == 4);
+  std::copy(grid.begin(), grid.end(), grid_.begin());
+  CopyCorners(corners, corners_);
+}
+
+
+bool MarkerPoseResidual::Evaluate(
+    double const *const *params,
+    double *r,
+    double **J) const
+{
+  const Eigen::Map<const Eigen::Matrix<double, 3, 1>> pt(params[0]);
+  const Eigen::Map<const Eigen::Quaternion<double>> pq(params[1]);
+  const Eigen::Map<const Eigen::Matrix<double, 3, 1>> mt(params[2]);
+  const Eigen::Map<const Eigen::Quaternion<double>> mq(params[3]);
+  if (mt.norm() > kMaxDistance || pt.norm() > kMaxDistance) {
+    return false;
+  }
+
+  const Eigen::Matrix<double, 3, 3> kr = k_ * pq.toRotationMatrix();
+  const Eigen::Matrix<double, 3, 3> mr = mq.toRotationMatrix();
+  for (size_t i = 0; i < 4; ++i) {
+    const Eigen::Matrix<double, 3, 1> w = mr * grid_[i] + mt;
+    const Eigen::Matrix<double, 3, 1> x = kr * w + k_ * pt;
+    const Eigen::Matrix<double, 2, 3> dx = Project(x, corners_[i], r + i * 2);
+    if (!J) {
+      continue;
+    }
+
+    const Eigen::Matrix<double, 2, 3> dpt = dx * k_;
+    const Eigen::Matrix<double, 2, 3> dmt = dx * kr;
+    if (J[0]) {
+      JacobianT(J[0]).block<2, 3>(i * 2, 0) = dpt;
+    }
+    if (J[1]) {
+      JacobianQ(J[1]).block<2, 4>(i * 2, 0) = dpt * RotationJacobian(pq, w);
+    }
+    if (J[2]) {
+      JacobianT(J[2]).block<2, 3>(i * 2, 0) = dmt;
+    }
+    if (J[3]) {
+      JacobianQ(J[3]).block<2, 4>(i * 2, 0) = dmt * RotationJacobian(mq, grid_[i]);
+    }
+  }
+  return true;
+}
+
+
+PoseResidual::PoseResidual(
+    const Eigen::Matrix<double, 4, 4> &k,
+    const Eigen::Matrix<double, 3, 1> &t,
+    const Eigen::Quaternion<double> &q,
+    const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+    const std::vector<cv::Point2f> &corners)
+  : k_(k.block<3, 3>(0, 0))
+{
+  assert(grid.size() == 4);
+  const Eigen::Matrix<double, 3, 3> mr = q.toRotationMatrix();
+  for (size_t i = 0; i < 4; ++i) {
+    world_[i] = mr * grid[i] + t;
+  }
+  CopyCorners(corners, corners_);
+}
+
+
+bool PoseResidual::Evaluate(
+    double const *const *params,
+    double *r,
+    double **J) const
+{
+  const Eigen::Map<const Eigen::Matrix<double, 3, 1>> pt(params[0]);
+  const Eigen::Map<const Eigen::Quaternion<double>> pq(params[1]);
+  if (pt.norm() > kMaxDistance) {
+    return false;
+  }
+
+  const Eigen::Matrix<double, 3, 3> kr = k_ * pq.toRotationMatrix();
+  for (size_t i = 0; i < 4; ++i) {
+    const Eigen::Matrix<double, 3, 1> x = kr * world_[i] + k_ * pt;
+    const Eigen::Matrix<double, 2, 3> dx = Project(x, corners_[i], r + i * 2);
+    if (!J) {
+      continue;
+    }
+
+    const Eigen::Matrix<double, 2, 3> dpt = dx * k_;
+    if (J[0]) {
+      JacobianT(J[0]).block<2, 3>(i * 2, 0) = dpt;
+    }
+    if (J[1]) {
+      JacobianQ(J[1]).block<2, 4>(i * 2, 0) = dpt * RotationJacobian(pq, world_[i]);
+    }
+  }
+  return true;
+}
+
+
+PositionPrior::PositionPrior(
+    const Eigen::Matrix<double, 3, 1> &t,
+    const Eigen::Matrix<double, 3, 3> &covariance)
+  : t_(t)
+  , weight_(covariance.llt().matrixL().solve(Eigen::Matrix<double, 3, 3>::Identity()))
+{
+}
+
+
+bool PositionPrior::Evaluate(
+    double const *const *params,
+    double *r,
+    double **J) const
+{
+  const Eigen::Map<const Eigen::Matrix<double, 3, 1>> mt(params[0]);
+  Eigen::Map<Eigen::Matrix<double, 3, 1>> residual(r);
+  residual = weight_ * (mt - t_);
+  if (J && J[0]) {
+    Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> jacobian(J[0]);
+    jacobian = weight_;
+  }
+  return true;
+}
+
+}
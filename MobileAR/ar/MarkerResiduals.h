@@ -0,0 +1,128 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <ceres/ceres.h>
+#include <opencv2/opencv.hpp>
+
+#include <Eigen/Eigen>
+
+
+namespace ar {
+
+/**
+ Reprojection error of the corners of a marker seen from a fixed pose.
+
+ Parameters are the position and the orientation of the marker. The
+ intrinsics are composed with the pose in advance.
+ */
+class MarkerResidual : public ceres::SizedCostFunction<8, 3, 4> {
+ public:
+  MarkerResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const Eigen::Matrix<double, 3, 1> &t,
+      const Eigen::Quaternion<double> &q,
+      const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+      const std::vector<cv::Point2f> &corners);
+
+  bool Evaluate(double const *const *params, double *r, double **J) const override;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  /// Intrinsics composed with the rotation of the pose.
+  Eigen::Matrix<double, 3, 3> kr_;
+  /// Intrinsics applied to the translation of the pose.
+  Eigen::Matrix<double, 3, 1> kt_;
+  /// Corners of the marker, in marker space.
+  std::array<Eigen::Matrix<double, 3, 1>, 4> grid_;
+  /// Observed corners.
+  std::array<Eigen::Matrix<double, 2, 1>, 4> corners_;
+};
+
+
+/**
+ Reprojection error of the corners of a marker seen from a pose.
+
+ Parameters are the position and the orientation of the pose, followed by
+ the position and the orientation of the marker.
+ */
+class MarkerPoseResidual : public ceres::SizedCostFunction<8, 3, 4, 3, 4> {
+ public:
+  MarkerPoseResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+      const std::vector<cv::Point2f> &corners);
+
+  bool Evaluate(double const *const *params, double *r, double **J) const override;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  /// Camera intrinsics.
+  Eigen::Matrix<double, 3, 3> k_;
+  /// Corners of the marker, in marker space.
+  std::array<Eigen::Matrix<double, 3, 1>, 4> grid_;
+  /// Observed corners.
+  std::array<Eigen::Matrix<double, 2, 1>, 4> corners_;
+};
+
+
+/**
+ Reprojection error of the corners of a fixed marker seen from a pose.
+
+ Parameters are the position and the orientation of the pose. The corners
+ are transformed to world space in advance.
+ */
+class PoseResidual : public ceres::SizedCostFunction<8, 3, 4> {
+ public:
+  PoseResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const Eigen::Matrix<double, 3, 1> &t,
+      const Eigen::Quaternion<double> &q,
+      const std::vector<Eigen::Matrix<double, 3, 1>> &grid,
+      const std::vector<cv::Point2f> &corners);
+
+  bool Evaluate(double const *const *params, double *r, double **J) const override;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  /// Camera intrinsics.
+  Eigen::Matrix<double, 3, 3> k_;
+  /// Corners of the marker, in world space.
+  std::array<Eigen::Matrix<double, 3, 1>, 4> world_;
+  /// Observed corners.
+  std::array<Eigen::Matrix<double, 2, 1>, 4> corners_;
+};
+
+
+/**
+ Deviation of a marker from a previously estimated position.
+
+ The parameter is the position of the marker. The deviation is whitened by
+ the covariance of the estimate, which must be positive definite.
+ */
+class PositionPrior : public ceres::SizedCostFunction<3, 3> {
+ public:
+  PositionPrior(
+      const Eigen::Matrix<double, 3, 1> &t,
+      const Eigen::Matrix<double, 3, 3> &covariance);
+
+  bool Evaluate(double const *const *params, double *r, double **J) const override;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  /// Estimated position.
+  Eigen::Matrix<double, 3, 1> t_;
+  /// Inverse of the Cholesky factor of the covariance.
+  Eigen::Matrix<double, 3, 3> weight_;
+};
+
+}
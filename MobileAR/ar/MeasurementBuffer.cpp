@@ -0,0 +1,135 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include "ar/MeasurementBuffer.h"
+
+namespace ar {
+
+MeasurementBuffer::Measurement MeasurementBuffer::Measurement::Inertial(
+    double time,
+    const Eigen::Quaternion<float> &q,
+    const Eigen::Matrix<float, 3, 1> &w,
+    const Eigen::Matrix<float, 3, 1> &a,
+    bool attitude)
+{
+  return { kInertial, time, q, w, a, Eigen::Matrix<float, 3, 1>::Zero(), attitude };
+}
+
+
+MeasurementBuffer::Measurement MeasurementBuffer::Measurement::Pose(
+    double time,
+    const Eigen::Quaternion<float> &q,
+    const Eigen::Matrix<float, 3, 1> &t)
+{
+  return {
+    kPose,
+    time,
+    q,
+    Eigen::Matrix<float, 3, 1>::Zero(),
+    Eigen::Matrix<float, 3, 1>::Zero(),
+    t,
+    false
+  };
+}
+
+
+MeasurementBuffer::MeasurementBuffer()
+  : head_(0)
+  , count_(0)
+{
+}
+
+
+int MeasurementBuffer::Add(const Measurement &m, EKFPose<float> &filter) {
+
+  // Find the position of the measurement, searching from the newest one
+  // since most measurements arrive in order.
+  size_t index = count_;
+  while (index > 0 && At(index - 1).m.time > m.time) {
+    --index;
+  }
+  if (index == 0 && count_ > 0) {
+    return -1;
+  }
+  const bool late = index < count_;
+
+  // Make room, dropping the oldest entry if full. A late measurement is
+  // applied to the state of the entry before it, which must not be dropped.
+  if (count_ == kCapacity) {
+    if (index <= 1) {
+      return -1;
+    }
+    head_ = (head_ + 1) % kCapacity;
+    --count_;
+    --index;
+  }
+  ++count_;
+  for (size_t i = count_ - 1; i > index; --i) {
+    At(i) = At(i - 1);
+  }
+
+  // Roll back to the state before a late measurement and apply it.
+  Entry *prev = index > 0 ? &At(index - 1) : nullptr;
+  if (late) {
+    filter = prev->state;
+  }
+  At(index).m = m;
+  Apply(prev, At(index), filter);
+
+  // Replay the newer measurements.
+  for (size_t i = index + 1; i < count_; ++i) {
+    Apply(&At(i - 1), At(i), filter);
+  }
+  return static_cast<int>(count_ - index - 1);
+}
+
+
+const EKFPose<float> &MeasurementBuffer::GetState(
+    double time,
+    const EKFPose<float> &filter) const
+{
+  for (size_t i = count_; i > 0; --i) {
+    if (At(i - 1).m.time <= time) {
+      return At(i - 1).state;
+    }
+  }
+  return filter;
+}
+
+
+void MeasurementBuffer::Apply(const Entry *prev, Entry &entry, EKFPose<float> &filter) {
+  const auto &m = entry.m;
+
+  // Each IMU reading is held until the next measurement, so the interval
+  // since the previous entry integrates the reading in effect after it.
+  // Inserting a pose thus splits an interval without changing its integral.
+  if (prev) {
+    filter.Predict(prev->w, prev->a, static_cast<float>(m.time - prev->m.time));
+  }
+
+  switch (m.type) {
+    case Measurement::kInertial: {
+      if (m.attitude) {
+        filter.CorrectAttitude(m.q);
+      }
+      entry.w = m.w;
+      entry.a = m.a;
+      break;
+    }
+    case Measurement::kPose: {
+      if (prev) {
+        entry.w = prev->w;
+        entry.a = prev->a;
+      } else {
+        entry.w.setZero();
+        entry.a.setZero();
+      }
+      filter.CorrectPose(m.q, m.t);
+      break;
+    }
+  }
+  entry.state = filter;
+}
+
+}
@@ -0,0 +1,133 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <array>
+
+#include <Eigen/Eigen>
+
+#include "ar/KalmanFilter.h"
+
+
+namespace ar {
+
+/**
+ Ring buffer of recent measurements and the filter states following them.
+
+ Measurements are applied to the filter in the order of their timestamps.
+ A measurement older than the latest one is applied to the state recorded
+ at its time, after which the newer measurements are replayed on top of it.
+ This way, camera poses arriving after detection are fused at the time the
+ frame was exposed instead of the time they become available.
+ */
+class MeasurementBuffer {
+ public:
+  /// Number of measurements kept, about a second of IMU samples.
+  static constexpr size_t kCapacity = 128;
+
+  /**
+   Sensor reading or tracked pose.
+   */
+  struct Measurement {
+    enum Type {
+      /// IMU sample, optionally with an attitude correction.
+      kInertial,
+      /// Camera pose from the tracker.
+      kPose,
+    };
+
+    /// Type of the measurement.
+    Type type;
+    /// Time of the measurement, in seconds.
+    double time;
+    /// Attitude of the device or orientation of the camera.
+    Eigen::Quaternion<float> q;
+    /// Angular velocity.
+    Eigen::Matrix<float, 3, 1> w;
+    /// Acceleration.
+    Eigen::Matrix<float, 3, 1> a;
+    /// Translation of the view transform.
+    Eigen::Matrix<float, 3, 1> t;
+    /// True if an inertial measurement corrects the attitude.
+    bool attitude;
+
+    /**
+     Creates an IMU sample.
+     */
+    static Measurement Inertial(
+        double time,
+        const Eigen::Quaternion<float> &q,
+        const Eigen::Matrix<float, 3, 1> &w,
+        const Eigen::Matrix<float, 3, 1> &a,
+        bool attitude);
+
+    /**
+     Creates a camera pose.
+     */
+    static Measurement Pose(
+        double time,
+        const Eigen::Quaternion<float> &q,
+        const Eigen::Matrix<float, 3, 1> &t);
+  };
+
+  /**
+   Creates an empty buffer.
+   */
+  MeasurementBuffer();
+
+  /**
+   Applies a measurement to the filter, replaying newer ones.
+
+   @param filter Filter holding the state after the latest measurement.
+   @return Number of newer measurements replayed, or -1 if the measurement
+           is older than the buffer and was dropped.
+   */
+  int Add(const Measurement &m, EKFPose<float> &filter);
+
+  /**
+   Returns the state of the filter after the last measurement up to a given
+   time, or the current state if the buffer has none.
+   */
+  const EKFPose<float> &GetState(double time, const EKFPose<float> &filter) const;
+
+ private:
+  /**
+   Recorded measurement.
+   */
+  struct Entry {
+    /// The measurement.
+    Measurement m;
+    /// IMU reading in effect after the measurement.
+    Eigen::Matrix<float, 3, 1> w;
+    Eigen::Matrix<float, 3, 1> a;
+    /// State of the filter after the measurement.
+    EKFPose<float> state;
+  };
+
+  /**
+   Returns the i-th oldest entry.
+   */
+  Entry &At(size_t i) {
+    return entries_[(head_ + i) % kCapacity];
+  }
+  const Entry &At(size_t i) const {
+    return entries_[(head_ + i) % kCapacity];
+  }
+
+  /**
+   Applies a measurement to the filter, following the entry before it.
+   */
+  static void Apply(const Entry *prev, Entry &entry, EKFPose<float> &filter);
+
+ private:
+  /// Storage of the ring buffer.
+  std::array<Entry, kCapacity> entries_;
+  /// Index of the oldest entry.
+  size_t head_;
+  /// Number of entries.
+  size_t count_;
+};
+
+}
@@ -15,25 +15,32 @@ MedianCutSampler::MedianCutSampler(size_t depth, const cv::Mat &image)
 {
 }
 
-void MedianCutSampler::split(const Region &region, int depth) {
+int MedianCutSampler::split(const Region &region, int depth) {
 
-  // If max depth was reached, return light source.
-  if (depth >= depth_) {
+  // Aggregate the light of the whole region, so all depths can be queried.
+  int node;
+  {
     const double area = m00_(region);
     if (std::abs(area) < 1e-5) {
-      lights_.push_back(sample(
+      node = insert(
           region,
+          depth,
           (region.y0 + region.y1) / 2,
           (region.x0 + region.x1) / 2
-      ));
+      );
     } else {
-      lights_.push_back(sample(
+      node = insert(
           region,
+          depth,
           static_cast<int>(m10_(region) / area),
           static_cast<int>(m01_(region) / area)
-      ));
+      );
     }
-    return;
+  }
+
+  // If max depth was reached, the node is a leaf.
+  if (depth >= depth_) {
+    return node;
   }
 
   if (width(region) < height(region)) {
@@ -54,8 +61,10 @@ void MedianCutSampler::split(const Region &region, int depth) {
       }
     }
     
-    split({ region.y0, region.x0, bestY + 0, region.x1 }, depth + 1);
-    split({ bestY + 1, region.x0, region.y1, region.x1 }, depth + 1);
+    const int left = split({ region.y0, region.x0, bestY + 0, region.x1 }, depth + 1);
+    const int right = split({ bestY + 1, region.x0, region.y1, region.x1 }, depth + 1);
+    tree_[node].left = left;
+    tree_[node].right = right;
   } else {
     // Try best cut along X.
     auto bestX = region.x0;
@@ -74,9 +83,13 @@ void MedianCutSampler::split(const Region &region, int depth) {
       }
     }
 
-    split({ region.y0, region.x0, region.y1, bestX + 0 }, depth + 1);
-    split({ region.y0, bestX + 1, region.y1, region.x1 }, depth + 1);
+    const int left = split({ region.y0, region.x0, region.y1, bestX + 0 }, depth + 1);
+    const int right = split({ region.y0, bestX + 1, region.y1, region.x1 }, depth + 1);
+    tree_[node].left = left;
+    tree_[node].right = right;
   }
+
+  return node;
 }
 
   
@@ -23,7 +23,7 @@ class MedianCutSampler : public LightProbeSampler{
   /**
    * Splits the image vertically or horizontally into two and recurses.
    */
-  void split(const Region &region, int depth);
+  int split(const Region &region, int depth);
   
  private:
   /// Moments.
@@ -0,0 +1,194 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "ar/OpticalFlow.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Maximal number of iterations on a level.
+constexpr int kMaxIterations = 30;
+/// Iterations stop once the update is shorter than this, in pixels.
+constexpr float kEpsilon = 0.01f;
+/// Points are lost if the smallest eigenvalue of the structure tensor,
+/// averaged over the window, is below this. Matches OpenCV's default.
+constexpr float kMinEigenvalue = 0.1f;
+
+
+/**
+ Samples a floating point image with bilinear interpolation, clamping
+ coordinates to the image.
+ */
+inline float Sample(const cv::Mat &image, float x, float y) {
+  x = std::min(std::max(x, 0.0f), static_cast<float>(image.cols - 1));
+  y = std::min(std::max(y, 0.0f), static_cast<float>(image.rows - 1));
+  const int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+  const int x1 = std::min(x0 + 1, image.cols - 1);
+  const int y1 = std::min(y0 + 1, image.rows - 1);
+  const float ax = x - x0, ay = y - y0;
+
+  const float *r0 = image.ptr<float>(y0);
+  const float *r1 = image.ptr<float>(y1);
+  return
+      (r0[x0] * (1.0f - ax) + r0[x1] * ax) * (1.0f - ay) +
+      (r1[x0] * (1.0f - ax) + r1[x1] * ax) * ay;
+}
+
+}
+
+
+OpticalFlow::OpticalFlow(int window, int maxLevel)
+  : window_(window)
+  , maxLevel_(maxLevel)
+  , frames_(0)
+  , pyramid_(maxLevel + 1)
+  , prevPyramid_(maxLevel + 1)
+  , patch_((window + 2) * (window + 2))
+  , dx_(window * window)
+  , dy_(window * window)
+{
+}
+
+
+void OpticalFlow::AddFrame(const cv::Mat &gray) {
+  assert(gray.type() == CV_8UC1);
+
+  // Reuse the buffers of the frame before the previous one.
+  std::swap(pyramid_, prevPyramid_);
+  ++frames_;
+
+  gray.convertTo(pyramid_[0], CV_32F);
+  for (int l = 1; l <= maxLevel_; ++l) {
+    const cv::Mat &src = pyramid_[l - 1];
+    cv::Mat &dst = pyramid_[l];
+    dst.create(src.rows >> 1, src.cols >> 1, CV_32F);
+    for (int r = 0; r < dst.rows; ++r) {
+      const float *s0 = src.ptr<float>((r << 1) + 0);
+      const float *s1 = src.ptr<float>((r << 1) + 1);
+      float *d = dst.ptr<float>(r);
+      for (int c = 0; c < dst.cols; ++c) {
+        d[c] = (s0[c << 1] + s0[(c << 1) + 1] + s1[c << 1] + s1[(c << 1) + 1]) * 0.25f;
+      }
+    }
+  }
+}
+
+
+bool OpticalFlow::HasPrevious() const {
+  return frames_ >= 2 && pyramid_[0].size() == prevPyramid_[0].size();
+}
+
+
+void OpticalFlow::Track(
+    const std::vector<cv::Point2f> &prev,
+    std::vector<cv::Point2f> &next,
+    std::vector<uint8_t> &status,
+    std::vector<float> &error)
+{
+  next.resize(prev.size());
+  status.resize(prev.size());
+  error.resize(prev.size());
+  for (size_t i = 0; i < prev.size(); ++i) {
+    status[i] = HasPrevious() && TrackPoint(prev[i], next[i], error[i]);
+  }
+}
+
+
+bool OpticalFlow::TrackPoint(const cv::Point2f &p, cv::Point2f &q, float &error) {
+  const int h = window_ / 2;
+  const int stride = window_ + 2;
+  const float area = static_cast<float>(window_ * window_);
+
+  // Estimate the flow from the coarsest level to the finest one.
+  float fx = 0.0f, fy = 0.0f;
+  for (int l = maxLevel_; l >= 0; --l) {
+    const cv::Mat &I = prevPyramid_[l];
+    const cv::Mat &J = pyramid_[l];
+    const float px = p.x / (1 << l), py = p.y / (1 << l);
+
+    // Sample the window of the previous frame with a border, then take
+    // central differences and sum up the structure tensor.
+    for (int y = 0; y < stride; ++y) {
+      for (int x = 0; x < stride; ++x) {
+        patch_[y * stride + x] = Sample(I, px + x - h - 1, py + y - h - 1);
+      }
+    }
+    float gxx = 0.0f, gxy = 0.0f, gyy = 0.0f;
+    for (int y = 0; y < window_; ++y) {
+      for (int x = 0; x < window_; ++x) {
+        const float *c = &patch_[(y + 1) * stride + x + 1];
+        const float ix = (c[1] - c[-1]) * 0.5f;
+        const float iy = (c[stride] - c[-stride]) * 0.5f;
+        dx_[y * window_ + x] = ix;
+        dy_[y * window_ + x] = iy;
+        gxx += ix * ix;
+        gxy += ix * iy;
+        gyy += iy * iy;
+      }
+    }
+    const float minEig = (gxx + gyy - std::sqrt((gxx - gyy) * (gxx - gyy) + 4.0f * gxy * gxy)) * 0.5f;
+    const float det = gxx * gyy - gxy * gxy;
+    if (minEig < kMinEigenvalue * area || det <= 0.0f) {
+      return false;
+    }
+
+    // Gauss-Newton iterations on the displacement of the window.
+    float qx = px + fx, qy = py + fy;
+    for (int it = 0; it < kMaxIterations; ++it) {
+      if (qx < -h || qx >= J.cols + h || qy < -h || qy >= J.rows + h) {
+        return false;
+      }
+
+      float bx = 0.0f, by = 0.0f;
+      for (int y = 0; y < window_; ++y) {
+        for (int x = 0; x < window_; ++x) {
+          const float diff =
+              patch_[(y + 1) * stride + x + 1] - Sample(J, qx + x - h, qy + y - h);
+          bx += diff * dx_[y * window_ + x];
+          by += diff * dy_[y * window_ + x];
+        }
+      }
+      const float ux = (gyy * bx - gxy * by) / det;
+      const float uy = (gxx * by - gxy * bx) / det;
+      qx += ux;
+      qy += uy;
+      if (ux * ux + uy * uy < kEpsilon * kEpsilon) {
+        break;
+      }
+    }
+
+    fx = qx - px;
+    fy = qy - py;
+    if (l > 0) {
+      fx *= 2.0f;
+      fy *= 2.0f;
+    }
+  }
+
+  q = { p.x + fx, p.y + fy };
+  if (q.x < 0.0f || q.x > pyramid_[0].cols - 1 || q.y < 0.0f || q.y > pyramid_[0].rows - 1) {
+    return false;
+  }
+
+  // Mean absolute difference of the windows at the finest level.
+  float sum = 0.0f;
+  for (int y = 0; y < window_; ++y) {
+    for (int x = 0; x < window_; ++x) {
+      sum += std::abs(
+          patch_[(y + 1) * stride + x + 1] -
+          Sample(pyramid_[0], q.x + x - h, q.y + y - h)
+      );
+    }
+  }
+  error = sum / area;
+  return true;
+}
+
+}
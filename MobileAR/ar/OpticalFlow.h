@@ -0,0 +1,79 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Pyramidal Lucas-Kanade tracker of sparse points between consecutive frames.
+
+ The pyramids of the two most recent frames are rebuilt in place and the
+ window buffers are allocated upfront, so tracking points in frames of the
+ same size does not allocate, unlike cv::calcOpticalFlowPyrLK.
+ */
+class OpticalFlow {
+ public:
+  /**
+   Creates a new tracker.
+
+   @param window   Side of the window matched around points, in pixels.
+   @param maxLevel Index of the coarsest pyramid level.
+   */
+  OpticalFlow(int window, int maxLevel);
+
+  /**
+   Builds the pyramid of a new 8 bit grayscale frame, keeping the one of the
+   previous frame.
+   */
+  void AddFrame(const cv::Mat &gray);
+
+  /**
+   Returns true if points can be tracked, i.e. the two most recent frames
+   had the same size.
+   */
+  bool HasPrevious() const;
+
+  /**
+   Tracks points from the previous frame to the most recent one.
+
+   @param status Non-zero for points which were found.
+   @param error  Mean absolute intensity difference of the matched windows.
+   */
+  void Track(
+      const std::vector<cv::Point2f> &prev,
+      std::vector<cv::Point2f> &next,
+      std::vector<uint8_t> &status,
+      std::vector<float> &error);
+
+ private:
+  /**
+   Tracks a single point, returning false if it was lost.
+   */
+  bool TrackPoint(const cv::Point2f &p, cv::Point2f &q, float &error);
+
+ private:
+  /// Side of the window.
+  const int window_;
+  /// Index of the coarsest level.
+  const int maxLevel_;
+  /// Number of frames added.
+  size_t frames_;
+  /// Floating point pyramid of the most recent frame.
+  std::vector<cv::Mat> pyramid_;
+  /// Floating point pyramid of the previous frame.
+  std::vector<cv::Mat> prevPyramid_;
+  /// Window of the previous frame, with a border for the derivatives.
+  std::vector<float> patch_;
+  /// Derivatives of the window of the previous frame.
+  std::vector<float> dx_;
+  std::vector<float> dy_;
+};
+
+}
@@ -0,0 +1,51 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Adapter turning a functor into an OpenCV loop body.
+ */
+template<typename F>
+class ParallelBody : public cv::ParallelLoopBody {
+ public:
+  ParallelBody(const F &f)
+    : f_(f)
+  {
+  }
+
+  void operator() (const cv::Range &range) const {
+    for (int i = range.start; i < range.end; ++i) {
+      f_(i);
+    }
+  }
+
+ private:
+  /// Function invoked for each index.
+  const F &f_;
+};
+
+
+/**
+ Invokes a function for all indices in [begin, end) on OpenCV's thread pool.
+ */
+template<typename F>
+void ParallelFor(int begin, int end, const F &f) {
+  cv::parallel_for_(cv::Range(begin, end), ParallelBody<F>(f));
+}
+
+
+/**
+ Number of stripes images are split into for parallel reductions.
+
+ The number is fixed so reductions are deterministic on all devices.
+ */
+constexpr int kParallelStripes = 16;
+
+}
@@ -0,0 +1,225 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <Eigen/Eigen>
+
+#include "ar/Parallel.h"
+#include "ar/SHProjector.h"
+
+
+namespace ar {
+
+namespace {
+
+/// Normalization constants of the real SH basis, up to band 3.
+constexpr float kY00 = 0.282095f;
+constexpr float kY1  = 0.488603f;
+constexpr float kY2  = 1.092548f;
+constexpr float kY20 = 0.315392f;
+constexpr float kY22 = 0.546274f;
+constexpr float kY33 = 0.590044f;
+constexpr float kY32 = 2.890611f;
+constexpr float kY31 = 0.457046f;
+constexpr float kY30 = 0.373176f;
+constexpr float kY3  = 1.445306f;
+
+/// Row-major list of per-pixel basis functions.
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> BasisMatrix;
+/// Planar RGB pixels of a row.
+typedef Eigen::Matrix<float, Eigen::Dynamic, 3> ColorMatrix;
+
+/**
+ Evaluates the basis for an entire row. Each column of the matrix holds one
+ basis function, so every assignment is a vectorized expression.
+ */
+void RowBasis(
+    size_t bands,
+    const Eigen::ArrayXf &x,
+    const Eigen::ArrayXf &y,
+    float z,
+    BasisMatrix &B)
+{
+  B.col(0).setConstant(kY00);
+  B.col(1) = (kY1 * y).matrix();
+  B.col(2).setConstant(kY1 * z);
+  B.col(3) = (kY1 * x).matrix();
+  B.col(4) = (kY2 * x * y).matrix();
+  B.col(5) = (kY2 * z * y).matrix();
+  B.col(6).setConstant(kY20 * (3.0f * z * z - 1.0f));
+  B.col(7) = (kY2 * z * x).matrix();
+  B.col(8) = (kY22 * (x * x - y * y)).matrix();
+  if (bands < 4) {
+    return;
+  }
+  B.col( 9) = (kY33 * y * (3.0f * x * x - y * y)).matrix();
+  B.col(10) = (kY32 * z * x * y).matrix();
+  B.col(11) = (kY31 * (5.0f * z * z - 1.0f) * y).matrix();
+  B.col(12).setConstant(kY30 * z * (5.0f * z * z - 3.0f));
+  B.col(13) = (kY31 * (5.0f * z * z - 1.0f) * x).matrix();
+  B.col(14) = (kY3 * z * (x * x - y * y)).matrix();
+  B.col(15) = (kY33 * x * (x * x - 3.0f * y * y)).matrix();
+}
+
+/**
+ Converts a row of RGB(A) pixels to planar RGB.
+ */
+template<typename T>
+void RowColor(const T *row, int cols, int chan, ColorMatrix &C) {
+  for (int c = 0; c < cols; ++c) {
+    const T *pix = &row[c * chan];
+    C(c, 0) = pix[0];
+    C(c, 1) = pix[1];
+    C(c, 2) = pix[2];
+  }
+}
+
+}
+
+
+SHProjector::SHProjector(size_t bands, int width)
+  : bands_(bands)
+  , width_(width)
+{
+  assert(bands_ == 3 || bands_ == 4);
+}
+
+
+std::vector<cv::Vec3f> SHProjector::operator() (const cv::Mat &envmap) const {
+
+  // Downsample the image if requested. Solid angles are derived from the
+  // resolution, so the result only loses high frequencies.
+  cv::Mat image = envmap;
+  if (width_ > 0 && envmap.cols > width_) {
+    cv::resize(
+        envmap,
+        image,
+        { width_, std::max(1, envmap.rows * width_ / envmap.cols) },
+        0, 0,
+        cv::INTER_AREA
+    );
+  }
+
+  // Validate the input and find the scale of the values.
+  const int rows = image.rows;
+  const int cols = image.cols;
+  const int chan = image.channels();
+  if (chan != 3 && chan != 4) {
+    throw std::runtime_error("Image must be either RGB or RGBA.");
+  }
+  float scale;
+  switch (image.depth()) {
+    case CV_8U: scale = 1.0f / 255.0f; break;
+    case CV_32F: scale = 1.0f; break;
+    default: {
+      throw std::runtime_error("Image must be 8 bit or floating point.");
+    }
+  }
+
+  // Azimuth of the pixel centres, shared by all rows.
+  Eigen::ArrayXf cosTheta(cols), sinTheta(cols);
+  for (int c = 0; c < cols; ++c) {
+    const double theta = 2.0 * M_PI * (c + 0.5) / cols;
+    cosTheta(c) = static_cast<float>(std::cos(theta));
+    sinTheta(c) = static_cast<float>(std::sin(theta));
+  }
+
+  // Project stripes of rows in parallel. Each row is reduced with a matrix
+  // product between the basis functions and the colours of the pixels.
+  const size_t count = bands_ * bands_;
+  std::vector<Eigen::Matrix<double, Eigen::Dynamic, 3>> partial(
+      kParallelStripes,
+      Eigen::Matrix<double, Eigen::Dynamic, 3>::Zero(count, 3)
+  );
+  ParallelFor(0, kParallelStripes, [&](int stripe) {
+    const int r0 = rows * (stripe + 0) / kParallelStripes;
+    const int r1 = rows * (stripe + 1) / kParallelStripes;
+
+    BasisMatrix B(cols, count);
+    ColorMatrix C(cols, 3);
+    Eigen::ArrayXf x(cols), y(cols);
+
+    for (int r = r0; r < r1; ++r) {
+      // Elevation of the pixel centre and the edges of the row.
+      const double phi0 = M_PI / 2.0 - M_PI * (r + 0.0) / rows;
+      const double phi  = M_PI / 2.0 - M_PI * (r + 0.5) / rows;
+      const double phi1 = M_PI / 2.0 - M_PI * (r + 1.0) / rows;
+
+      // Solid angle of a pixel in the row.
+      const float w = static_cast<float>(
+          2.0 * M_PI / cols * (std::sin(phi0) - std::sin(phi1)) * scale
+      );
+
+      // Directions towards all pixels of the row.
+      const float z = static_cast<float>(std::sin(phi));
+      x = static_cast<float>(std::cos(phi)) * cosTheta;
+      y = static_cast<float>(std::cos(phi)) * sinTheta;
+      RowBasis(bands_, x, y, z, B);
+
+      // Fetch the pixels.
+      switch (image.depth()) {
+        case CV_8U: RowColor(image.ptr<uint8_t>(r), cols, chan, C); break;
+        case CV_32F: RowColor(image.ptr<float>(r), cols, chan, C); break;
+      }
+
+      partial[stripe].noalias() += (w * (B.transpose() * C)).cast<double>();
+    }
+  });
+
+  // Reduce the stripes.
+  Eigen::Matrix<double, Eigen::Dynamic, 3> sum = Eigen::Matrix<double, Eigen::Dynamic, 3>::Zero(count, 3);
+  for (const auto &p : partial) {
+    sum += p;
+  }
+
+  std::vector<cv::Vec3f> sh;
+  for (size_t i = 0; i < count; ++i) {
+    sh.emplace_back(sum(i, 0), sum(i, 1), sum(i, 2));
+  }
+  return sh;
+}
+
+
+std::vector<cv::Vec3f> SHProjector::irradiance(const std::vector<cv::Vec3f> &sh) {
+  // Coefficients of the clamped cosine lobe, per band.
+  static const float kA[] = {
+    static_cast<float>(M_PI),
+    static_cast<float>(2.0 * M_PI / 3.0),
+    static_cast<float>(M_PI / 4.0),
+    0.0f
+  };
+
+  std::vector<cv::Vec3f> e;
+  for (size_t i = 0; i < sh.size(); ++i) {
+    const auto band = static_cast<size_t>(std::sqrt(static_cast<float>(i)));
+    e.push_back(sh[i] * kA[band]);
+  }
+  return e;
+}
+
+
+cv::Vec3f SHProjector::evaluate(
+    const std::vector<cv::Vec3f> &sh,
+    float x,
+    float y,
+    float z)
+{
+  assert(sh.size() == 9 || sh.size() == 16);
+
+  BasisMatrix B(1, sh.size());
+  RowBasis(
+      sh.size() == 9 ? 3 : 4,
+      Eigen::ArrayXf::Constant(1, x),
+      Eigen::ArrayXf::Constant(1, y),
+      z,
+      B
+  );
+
+  cv::Vec3f v(0.0f, 0.0f, 0.0f);
+  for (size_t i = 0; i < sh.size(); ++i) {
+    v += sh[i] * B(0, i);
+  }
+  return v;
+}
+
+}
@@ -0,0 +1,54 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+
+namespace ar {
+
+/**
+ Projects equirectangular environment maps onto spherical harmonics.
+ 
+ Coefficients are stored band by band as RGB triples. Directions point from
+ the centre of the sphere towards the environment, with Z pointing up.
+ */
+class SHProjector {
+ public:
+  /**
+   Creates a projector.
+   
+   @param bands Number of bands: 3 for 9 coefficients, 4 for 16.
+   @param width If non-zero, images are downsampled to this width first.
+   */
+  SHProjector(size_t bands = 3, int width = 0);
+
+  /**
+   Projects an 8 bit LDR or floating point HDR RGB(A) image.
+   */
+  std::vector<cv::Vec3f> operator() (const cv::Mat &image) const;
+
+  /**
+   Convolves radiance coefficients with the clamped cosine lobe.
+   
+   The result evaluates to the irradiance around a normal.
+   */
+  static std::vector<cv::Vec3f> irradiance(const std::vector<cv::Vec3f> &sh);
+
+  /**
+   Evaluates a set of coefficients in a direction.
+   */
+  static cv::Vec3f evaluate(const std::vector<cv::Vec3f> &sh, float x, float y, float z);
+
+ private:
+  /// Number of bands.
+  const size_t bands_;
+  /// Width of the downsampled image.
+  const int width_;
+};
+
+}
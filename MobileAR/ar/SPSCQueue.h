@@ -0,0 +1,78 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+namespace ar {
+
+/**
+ Lock-free ring buffer between a single producer and a single consumer.
+
+ Slots are allocated once and filled in place, so buffers owned by the
+ elements are reused. The producer fills the slot returned by Back and
+ publishes it with Push, while the consumer reads the slot returned by Front
+ and releases it with Pop.
+ */
+template<typename T, size_t N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity must be a power of two.");
+
+ public:
+  SPSCQueue()
+    : head_(0)
+    , tail_(0)
+  {
+  }
+
+  /**
+   Returns the slot to be filled by the producer, or nullptr if full.
+   */
+  T *Back() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == N) {
+      return nullptr;
+    }
+    return &slots_[tail & (N - 1)];
+  }
+
+  /**
+   Publishes the slot returned by Back to the consumer.
+   */
+  void Push() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /**
+   Returns the oldest published slot, or nullptr if empty.
+   */
+  T *Front() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots_[head & (N - 1)];
+  }
+
+  /**
+   Returns the slot read through Front to the producer.
+   */
+  void Pop() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+ private:
+  /// Preallocated elements.
+  std::array<T, N> slots_;
+  /// Index of the next slot to be read, owned by the consumer.
+  alignas(64) std::atomic<size_t> head_;
+  /// Index of the next slot to be written, owned by the producer.
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+}
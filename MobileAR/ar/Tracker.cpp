@@ -13,6 +13,24 @@ namespace {
 const size_t kRelativePoses = 50;
 /// Gravitational acceleration, in cm/s^2.
 static const float G = 9.80665 * 100;
+/// Weight of new samples in the latency averages.
+const float kLatencyWeight = 0.05f;
+/// Time between corrections with the attitude reported by the device, in s.
+const double kAttitudeInterval = 0.1;
+
+
+/**
+ Updates a moving average with the time elapsed since a point.
+ */
+void Measure(
+    std::atomic<float> &average,
+    const std::chrono::steady_clock::time_point &from,
+    const std::chrono::steady_clock::time_point &to)
+{
+  const float ms = std::chrono::duration<float, std::milli>(to - from).count();
+  const float prev = average.load(std::memory_order_relaxed);
+  average.store(prev + (ms - prev) * kLatencyWeight, std::memory_order_relaxed);
+}
 
 }
 
@@ -21,29 +39,62 @@ static const float G = 9.80665 * 100;
 Tracker::Tracker(const cv::Mat &k, const cv::Mat &d)
   : k(k)
   , d(d)
+  , relativePose(Eigen::Quaternion<float>::Identity())
+  , stateSeq_(0)
+  , running_(false)
+  , tracked_(false)
+  , lastFrame_(0.0)
+  , lastAttitude_(0.0)
+  , queueLatency_(0.0f)
+  , detectLatency_(0.0f)
+  , solveLatency_(0.0f)
 {
   K = Eigen::Matrix<double, 4, 4>::Identity();
   K(0, 0) = k.at<double>(0, 0);
   K(1, 1) = k.at<double>(1, 1);
   K(0, 2) = k.at<double>(0, 2);
   K(1, 2) = k.at<double>(1, 2);
+
+  Publish();
 }
 
 Tracker::~Tracker() {
+  StopPipeline();
 }
 
 
-bool Tracker::TrackFrame(const cv::Mat &frame, float dt) {
-
-  // Get the current rotation.
-  const auto r = kfr.GetOrientation();
+bool Tracker::TrackFrame(const cv::Mat &frame, double time) {
 
   // Delegate to the underlying tracker.
-  const auto result = TrackFrameImpl(frame, dt);
+  const auto result = TrackFrameImpl(frame, time);
   if (!result.tracked) {
     return false;
   }
 
+  Update(result, time);
+  return true;
+}
+
+
+float Tracker::FrameTime(double time) {
+  const float dt = lastFrame_ > 0.0 ? static_cast<float>(time - lastFrame_) : 0.0f;
+  lastFrame_ = time;
+  return dt;
+}
+
+
+Tracker::TrackingResult Tracker::TrackFrameImpl(const cv::Mat &frame, double time) {
+  Detect(frame, time, observation_);
+  return Solve(observation_, FrameTime(time));
+}
+
+
+void Tracker::Update(const TrackingResult &result, double time) {
+  std::lock_guard<std::mutex> lock(filterLock_);
+
+  // Orientation of the filter when the frame was captured.
+  const auto r = measurements_.GetState(time, kf).GetOrientation();
+
   // Limit the size of the pose buffer.
   if (relativePoses.size() > kRelativePoses) {
     relativePoses.erase(relativePoses.begin(), relativePoses.begin() + 1);
@@ -53,30 +104,230 @@ bool Tracker::TrackFrame(const cv::Mat &frame, float dt) {
   if (relativePoses.size() > 0) {
 
     // Find the world rotation, as provided by the marker.
-    Eigen::Quaternion<float> relativePose = QuaternionAverage(relativePoses);
+    relativePose = QuaternionAverage(relativePoses);
 
-    // Update the filter.
-    kfr.UpdateMarker(result.q * relativePose, dt);
-    kfp.UpdateMarker(result.t, dt);
+    // Update the filter at the time of the frame.
+    measurements_.Add(
+        MeasurementBuffer::Measurement::Pose(time, result.q * relativePose, result.t),
+        kf
+    );
   }
 
   relativePoses.push_back(result.q.inverse() * r);
+  Publish();
+}
+
+
+void Tracker::StartPipeline() {
+  if (running_) {
+    return;
+  }
+
+  running_ = true;
+  detectThread_ = std::thread(&Tracker::RunDetection, this);
+  solveThread_ = std::thread(&Tracker::RunSolver, this);
+}
+
+
+void Tracker::StopPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(wakeLock_);
+    running_ = false;
+  }
+  frameReady_.notify_all();
+  detectionReady_.notify_all();
+
+  if (detectThread_.joinable()) {
+    detectThread_.join();
+  }
+  if (solveThread_.joinable()) {
+    solveThread_.join();
+  }
+}
+
+
+bool Tracker::QueueFrame(const cv::Mat &frame, double time) {
+  if (auto *slot = frames_.Back()) {
+    // Copy into the slot, reusing its buffer.
+    frame.copyTo(slot->image);
+    slot->time = time;
+    slot->queued = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(wakeLock_);
+      frames_.Push();
+    }
+    frameReady_.notify_one();
+  }
+
+  return tracked_;
+}
+
+
+void Tracker::RunDetection() {
+  while (running_) {
+    Frame *frame = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(wakeLock_);
+      frameReady_.wait(lock, [&] {
+        return !running_ || (frame = frames_.Front()) != nullptr;
+      });
+    }
+    if (!running_) {
+      break;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    Measure(queueLatency_, frame->queued, start);
+
+    Detection *detection = detections_.Back();
+    if (!detection) {
+      frames_.Pop();
+      continue;
+    }
+
+    // Detect features on the grayscale frame.
+    if (frame->image.channels() == 4) {
+      cv::cvtColor(frame->image, gray_, CV_BGRA2GRAY);
+    } else {
+      gray_ = frame->image;
+    }
+    Detect(gray_, frame->time, detection->observation);
+    detection->time = frame->time;
+    frames_.Pop();
+
+    detection->detected = std::chrono::steady_clock::now();
+    Measure(detectLatency_, start, detection->detected);
+    {
+      std::lock_guard<std::mutex> lock(wakeLock_);
+      detections_.Push();
+    }
+    detectionReady_.notify_one();
+  }
+}
+
+
+void Tracker::RunSolver() {
+  while (running_) {
+    Detection *detection = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(wakeLock_);
+      detectionReady_.wait(lock, [&] {
+        return !running_ || (detection = detections_.Front()) != nullptr;
+      });
+    }
+    if (!running_) {
+      break;
+    }
+
+    const auto result = Solve(detection->observation, FrameTime(detection->time));
+    if (result.tracked) {
+      Update(result, detection->time);
+    }
+    tracked_ = result.tracked;
+
+    Measure(solveLatency_, detection->detected, std::chrono::steady_clock::now());
+    detections_.Pop();
+  }
+}
+
+
+bool Tracker::PredictPose(
+    double time,
+    Eigen::Quaternion<float> &q,
+    Eigen::Matrix<float, 3, 1> &t)
+{
+  std::lock_guard<std::mutex> lock(filterLock_);
+
+  // The state closest to the frame, which integrated the IMU samples since
+  // the last pose. Poses are fused in the frame of the relative orientation.
+  const auto &state = measurements_.GetState(time, kf);
+  if (!state.HasPosition()) {
+    return false;
+  }
+  q = state.GetOrientation() * relativePose.inverse();
+  t = state.GetTranslation();
   return true;
 }
 
+
 bool Tracker::TrackSensor(
     const Eigen::Quaternion<float> &q,
     const Eigen::Matrix<float, 3, 1> &a,
     const Eigen::Matrix<float, 3, 1> &w,
-    float dt)
+    double time)
 {
-  const auto r = kfr.GetOrientation();
+  std::lock_guard<std::mutex> lock(filterLock_);
+
+  // Every sample is integrated, while the attitude, which the device
+  // already filters, only corrects the state periodically.
+  const bool attitude = time - lastAttitude_ >= kAttitudeInterval;
+  if (attitude) {
+    lastAttitude_ = time;
+  }
+  measurements_.Add(
+      MeasurementBuffer::Measurement::Inertial(time, q, w, a * G, attitude),
+      kf
+  );
 
-  kfr.UpdateIMU(q, w, dt);
-  kfp.UpdateIMU(r.inverse().toRotationMatrix() * a * G, dt);
-  
+  Publish();
   return true;
 }
-  
+
+
+void Tracker::Publish() {
+  const auto q = kf.GetOrientation();
+  const auto t = kf.GetTranslation();
+  const float values[] = { q.x(), q.y(), q.z(), q.w(), t.x(), t.y(), t.z() };
+
+  // Readers retry while the sequence number is odd or has changed.
+  const uint32_t seq = stateSeq_.load(std::memory_order_relaxed);
+  stateSeq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < state_.size(); ++i) {
+    state_[i].store(values[i], std::memory_order_relaxed);
+  }
+  stateSeq_.store(seq + 2, std::memory_order_release);
+}
+
+
+Eigen::Matrix<float, 3, 1> Tracker::GetPosition() const {
+  Eigen::Quaternion<float> q;
+  Eigen::Matrix<float, 3, 1> t;
+  GetPose(q, t);
+  return t;
 }
 
+
+Eigen::Quaternion<float> Tracker::GetOrientation() const {
+  Eigen::Quaternion<float> q;
+  Eigen::Matrix<float, 3, 1> t;
+  GetPose(q, t);
+  return q;
+}
+
+
+void Tracker::GetPose(Eigen::Quaternion<float> &q, Eigen::Matrix<float, 3, 1> &t) const {
+  float values[7];
+  uint32_t seq;
+  do {
+    seq = stateSeq_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < state_.size(); ++i) {
+      values[i] = state_[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != stateSeq_.load(std::memory_order_relaxed));
+
+  q = Eigen::Quaternion<float>(values[3], values[0], values[1], values[2]);
+  t = { values[4], values[5], values[6] };
+}
+
+
+Tracker::Latency Tracker::GetLatency() const {
+  return {
+    queueLatency_.load(std::memory_order_relaxed),
+    detectLatency_.load(std::memory_order_relaxed),
+    solveLatency_.load(std::memory_order_relaxed)
+  };
+}
+
+}
@@ -4,20 +4,49 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <Eigen/Eigen>
 
 #include <opencv2/opencv.hpp>
 
 #include "ar/KalmanFilter.h"
+#include "ar/MeasurementBuffer.h"
+#include "ar/SPSCQueue.h"
 
 
 namespace ar {
 
 /**
  Abstract base class for tracking systems.
+
+ Frames are either tracked synchronously with TrackFrame or, once the
+ pipeline is started, queued with QueueFrame. In the latter case, features
+ are detected on one worker thread and handed to a second one, which solves
+ for the pose and updates the filters.
  */
 class Tracker {
+  friend class TrackerArbiter;
+
  public:
+  /**
+   Average latencies of the pipeline stages, in milliseconds.
+   */
+  struct Latency {
+    /// Time between queueing a frame and the start of detection.
+    float queue;
+    /// Time spent detecting features.
+    float detect;
+    /// Time between detection and the updated filter state.
+    float solve;
+  };
+
   /**
    Creates a new tracker.
    */
@@ -30,31 +59,64 @@ class Tracker {
 
   /**
    Performs tracking based on camera data.
+
+   @param time Time the frame was captured at, in seconds, on the same clock
+               as the sensor timestamps.
+   */
+  bool TrackFrame(const cv::Mat &frame, double time);
+
+  /**
+   Starts the detection and pose solver threads.
    */
-  bool TrackFrame(const cv::Mat &frame, float dt);
+  void StartPipeline();
 
   /**
-   Performs tracking based on sensor data.
+   Stops the pipeline threads. Subclasses must stop the pipeline in their
+   destructor, since the threads call their methods.
+   */
+  void StopPipeline();
+
+  /**
+   Queues a BGRA or grayscale frame for the pipeline, without waiting for it
+   to be processed. Frames are dropped if the detector is busy.
+
+   @param time Time the frame was captured at, in seconds.
+   @return True if the last processed frame was tracked.
+   */
+  bool QueueFrame(const cv::Mat &frame, double time);
+
+  /**
+   Performs tracking based on sensor data. Meant to be called at the full
+   rate of the sensors, since samples are integrated cheaply.
+
+   @param time Time of the sample, in seconds.
    */
   bool TrackSensor(
       const Eigen::Quaternion<float> &q,
       const Eigen::Matrix<float, 3, 1> &a,
       const Eigen::Matrix<float, 3, 1> &w,
-      float dt);
+      double time);
 
   /**
    Returns the position of the camera.
    */
-  Eigen::Matrix<float, 3, 1> GetPosition() const {
-    return kfp.GetPosition();
-  }
+  Eigen::Matrix<float, 3, 1> GetPosition() const;
 
   /**
    Returns the orientation of the camera.
    */
-  Eigen::Quaternion<float> GetOrientation() const {
-    return kfr.GetOrientation();
-  }
+  Eigen::Quaternion<float> GetOrientation() const;
+
+  /**
+   Returns the orientation and the position of the camera, both taken from
+   the same published state.
+   */
+  void GetPose(Eigen::Quaternion<float> &q, Eigen::Matrix<float, 3, 1> &t) const;
+
+  /**
+   Returns the latencies of the pipeline stages.
+   */
+  Latency GetLatency() const;
 
   /**
    Returns the tracked markers.
@@ -71,12 +133,92 @@ class Tracker {
     Eigen::Matrix<float, 3, 1> t;
   };
 
+  /**
+   Features found in a frame, passed from detection to the pose solver.
+   */
+  struct Observation {
+    /// Identifiers of the features.
+    std::vector<int> ids;
+    /// Image points of the features.
+    std::vector<std::vector<cv::Point2f>> corners;
+    /// True if the features were tracked from the previous frame instead
+    /// of being detected, so the previous pose is a good initial guess.
+    bool tracked;
+
+    Observation() : tracked(false) {}
+  };
+
   /**
    Tracker-specific implementation of frame processing.
    */
-  virtual TrackingResult TrackFrameImpl(
-      const cv::Mat &frame,
-      float dt) = 0;
+  TrackingResult TrackFrameImpl(const cv::Mat &frame, double time);
+
+  /**
+   Detects features in a grayscale frame.
+
+   @param time Time the frame was captured at, in seconds.
+   */
+  virtual void Detect(const cv::Mat &frame, double time, Observation &observation) = 0;
+
+  /**
+   Finds the pose of the camera from the detected features.
+   */
+  virtual TrackingResult Solve(const Observation &observation, float dt) = 0;
+
+  /**
+   Returns the pose the filter estimates for a frame captured at some time,
+   in the frame of the tracking results.
+
+   @return False if the filter was not yet initialized by a tracked pose.
+   */
+  bool PredictPose(
+      double time,
+      Eigen::Quaternion<float> &q,
+      Eigen::Matrix<float, 3, 1> &t);
+
+ private:
+  /**
+   Frame queued for detection.
+   */
+  struct Frame {
+    cv::Mat image;
+    double time;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  /**
+   Features queued for the pose solver.
+   */
+  struct Detection {
+    Observation observation;
+    double time;
+    std::chrono::steady_clock::time_point detected;
+  };
+
+  /**
+   Updates the filter with a pose tracked in a frame captured at some time.
+   */
+  void Update(const TrackingResult &result, double time);
+
+  /**
+   Returns the time elapsed since the previously tracked frame.
+   */
+  float FrameTime(double time);
+
+  /**
+   Publishes the state of the filters to readers. Requires filterLock_.
+   */
+  void Publish();
+
+  /**
+   Detection thread.
+   */
+  void RunDetection();
+
+  /**
+   Pose solver thread.
+   */
+  void RunSolver();
 
  protected:
   /// Eigen version of the intrinsic matrix.
@@ -87,11 +229,55 @@ class Tracker {
   cv::Mat d;
 
   // Kalman filter state.
-  EKFOrientation<float> kfr;
-  EKFPosition<float> kfp;
+  EKFPose<float> kf;
 
   // List of relative orientations, measured between the world and marker frame.
   std::vector<Eigen::Quaternion<float>> relativePoses;
+  // Average of the relative orientations, applied to tracked poses.
+  Eigen::Quaternion<float> relativePose;
+
+ private:
+  /// Guard serializing filter updates from the camera and the sensors.
+  std::mutex filterLock_;
+  /// Sequence number of the published state, odd while it is written.
+  std::atomic<uint32_t> stateSeq_;
+  /// Published orientation (x, y, z, w) and position.
+  std::array<std::atomic<float>, 7> state_;
+
+  /// Observation used by synchronous tracking.
+  Observation observation_;
+
+  /// Frames waiting for detection.
+  SPSCQueue<Frame, 2> frames_;
+  /// Detections waiting for the pose solver.
+  SPSCQueue<Detection, 4> detections_;
+  /// Grayscale version of the frame being detected.
+  cv::Mat gray_;
+  /// Guard for the condition variables.
+  std::mutex wakeLock_;
+  /// Signals queued frames.
+  std::condition_variable frameReady_;
+  /// Signals queued detections.
+  std::condition_variable detectionReady_;
+  /// Flag to stop the pipeline.
+  std::atomic<bool> running_;
+  /// Detection thread.
+  std::thread detectThread_;
+  /// Pose solver thread.
+  std::thread solveThread_;
+  /// True if the last frame processed by the pipeline was tracked.
+  std::atomic<bool> tracked_;
+  /// Capture time of the last frame passed to the solver.
+  double lastFrame_;
+  /// Time of the last attitude correction.
+  double lastAttitude_;
+  /// Recent measurements, to fuse delayed camera poses at their time.
+  MeasurementBuffer measurements_;
+
+  /// Moving averages of stage latencies.
+  std::atomic<float> queueLatency_;
+  std::atomic<float> detectLatency_;
+  std::atomic<float> solveLatency_;
 };
 
-}
\ No newline at end of file
+}
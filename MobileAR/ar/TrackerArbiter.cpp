@@ -0,0 +1,43 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include "ar/Parallel.h"
+#include "ar/TrackerArbiter.h"
+
+namespace ar {
+
+TrackerArbiter::TrackerArbiter(const std::vector<std::shared_ptr<Tracker>> &candidates)
+  : candidates_(candidates)
+  , observations_(candidates.size())
+{
+}
+
+
+std::shared_ptr<Tracker> TrackerArbiter::TrackFrame(const cv::Mat &frame, double time) {
+
+  // Detection is the expensive step, so all candidates run it at once.
+  ParallelFor(0, static_cast<int>(candidates_.size()), [&](int i) {
+    candidates_[i]->Detect(frame, time, observations_[i]);
+  });
+
+  // Solve in order of preference. Candidates after the first successful
+  // one are not solved for at all.
+  for (size_t i = 0; i < candidates_.size(); ++i) {
+    const auto &tracker = candidates_[i];
+    const auto result = tracker->Solve(observations_[i], tracker->FrameTime(time));
+    if (!result.tracked) {
+      continue;
+    }
+
+    tracker->Update(result, time);
+    auto chosen = tracker;
+    candidates_.clear();
+    observations_.clear();
+    return chosen;
+  }
+
+  return nullptr;
+}
+
+}
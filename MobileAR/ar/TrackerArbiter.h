@@ -0,0 +1,49 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ar/Tracker.h"
+
+
+namespace ar {
+
+/**
+ Selects a tracker out of multiple candidates.
+
+ Candidates detect features on the same frame concurrently. Poses are then
+ solved in the order of the candidates, stopping at the first successful one,
+ which is chosen. The remaining candidates are released once a tracker is
+ chosen, shutting down their threads.
+ */
+class TrackerArbiter {
+ public:
+  /**
+   Creates an arbiter.
+
+   @param candidates Trackers to choose from, in order of preference.
+   */
+  TrackerArbiter(const std::vector<std::shared_ptr<Tracker>> &candidates);
+
+  /**
+   Tracks a grayscale frame with all candidates.
+
+   @param time Time the frame was captured at, in seconds.
+   @return The chosen tracker, or nullptr if none of them tracked the frame.
+   */
+  std::shared_ptr<Tracker> TrackFrame(const cv::Mat &frame, double time);
+
+ private:
+  /// Trackers not yet retired.
+  std::vector<std::shared_ptr<Tracker>> candidates_;
+  /// Features found by each of the candidates.
+  std::vector<Tracker::Observation> observations_;
+};
+
+}
@@ -19,7 +19,7 @@ enum ARCameraError : ErrorType {
  Protocol to handle frames.
  */
 protocol ARCameraDelegate {
-  func onCameraFrame(frame: UIImage)
+  func onCameraFrame(frame: UIImage, time: CMTime)
 }
 
 enum ARCameraResolution {
@@ -173,7 +173,10 @@ class ARCamera : NSObject, AVCaptureVideoDataOutputSampleBufferDelegate {
       return
     }
 
-    delegate?.onCameraFrame(UIImage(CGImage: image))
+    delegate?.onCameraFrame(
+        UIImage(CGImage: image),
+        time: CMSampleBufferGetPresentationTimeStamp(sampleBuffer)
+    )
   }
 
   /**
@@ -113,9 +113,24 @@ class AREnvironment {
     }
     self.hdr = ARHDRImage(data: NSData(contentsOfFile: hdrPath)!)
 
-    // Sample so we can adjust levels.
-    self.lightsLDR = ARLightProbeSampler.sampleVarianceCutLDR(ldr, levels: kSamplingLevels)
-    self.lightsHDR = ARLightProbeSampler.sampleVarianceCutHDR(hdr, levels: kSamplingLevels)
+    // Sample so we can adjust levels. Lights are stored next to the maps and
+    // are only sampled again if the maps changed.
+    guard let ldrLightsPath = path.URLByAppendingPathComponent("lights_ldr.bin").path else {
+      throw AREnvironmentError.MalformedData
+    }
+    guard let hdrLightsPath = path.URLByAppendingPathComponent("lights_hdr.bin").path else {
+      throw AREnvironmentError.MalformedData
+    }
+    self.lightsLDR = ARLightProbeSampler.sampleVarianceCutLDR(
+        ldr,
+        levels: kSamplingLevels,
+        cache: ldrLightsPath
+    )
+    self.lightsHDR = ARLightProbeSampler.sampleVarianceCutHDR(
+        hdr,
+        levels: kSamplingLevels,
+        cache: hdrLightsPath
+    )
   }
 
   /**
@@ -66,7 +66,7 @@ class ARHDRCamera : ARCamera, ARCameraDelegate {
   /**
    Called when a frame is ready.
    */
-  func onCameraFrame(frame: UIImage) {
+  func onCameraFrame(frame: UIImage, time: CMTime) {
     
     guard !configuring else {
       return
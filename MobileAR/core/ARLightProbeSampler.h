@@ -32,4 +32,16 @@
  */
 + (NSArray<ARLight*>*)sampleMedianCutHDR:(ARHDRImage*)image levels:(size_t)levels;
 
+/**
+ Samples using variance cut sampling, reusing lights stored in a file if the
+ file was produced from the same image. Stale files are overwritten.
+ */
++ (NSArray<ARLight*>*)sampleVarianceCutLDR:(UIImage*)image levels:(size_t)levels cache:(NSString*)path;
+
+/**
+ Samples a HDR image using variance cut sampling, reusing lights stored in a
+ file if the file was produced from the same image. Stale files are overwritten.
+ */
++ (NSArray<ARLight*>*)sampleVarianceCutHDR:(ARHDRImage*)image levels:(size_t)levels cache:(NSString*)path;
+
 @end
\ No newline at end of file
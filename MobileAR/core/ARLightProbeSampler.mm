@@ -8,11 +8,26 @@
 
 #include <memory>
 
+#include <simd/simd.h>
+
+#include "LightCache.h"
 #include "LightProbeSampler.h"
 #include "MedianCutSampler.h"
 #include "VarianceCutSampler.h"
 
 
+namespace {
+
+/**
+ Converts a vector from the sampler to a type understood by the renderer.
+ */
+simd::float3 ToSIMD(const ar::LightVector &v) {
+  return simd::float3{ v.x(), v.y(), v.z() };
+}
+
+}
+
+
 @implementation ARLightProbeSampler
 {
 }
@@ -41,19 +56,48 @@
 }
 
 
++ (NSArray<ARLight*>*)sampleVarianceCutLDR:(UIImage*)image levels:(size_t)levels cache:(NSString*)path
+{
+  return [ARLightProbeSampler sampleVarianceCut: [image cvMat] levels: levels cache: path];
+}
+
+
++ (NSArray<ARLight*>*)sampleVarianceCutHDR:(ARHDRImage*)image levels:(size_t)levels cache:(NSString*)path
+{
+  return [ARLightProbeSampler sampleVarianceCut: [image cvMat] levels: levels cache: path];
+}
+
+
++ (NSArray<ARLight*>*)sampleVarianceCut:(const cv::Mat&)image levels:(size_t)levels cache:(NSString*)path
+{
+  // Resample only if the stored lights are missing or stale.
+  ar::LightCache cache([path UTF8String], ar::LightCache::VARIANCE_CUT, levels, image);
+  std::vector<ar::LightSource> lights;
+  if (!cache.read(lights)) {
+    lights = ar::VarianceCutSampler(levels, image)();
+    cache.write(lights);
+  }
+  return [ARLightProbeSampler convert: lights];
+}
+
+
 + (NSArray<ARLight*>*)sample:(ar::LightProbeSampler&&)sampler
 {
   // Sample the light sources in the image.
-  auto lights = sampler();
+  return [ARLightProbeSampler convert: sampler()];
+}
 
+
++ (NSArray<ARLight*>*)convert:(const std::vector<ar::LightSource>&)lights
+{
   // Convert light sources to Swift ARLight.
   std::vector<ARLight*> ptrs;
   for (const auto &light: lights) {
     ptrs.push_back([[ARLight alloc]
-        initWithDirection: light.direction
-        ambient: light.ambient
-        diffuse: light.diffuse
-        specular: light.specular
+        initWithDirection: ToSIMD(light.direction)
+        ambient: ToSIMD(light.ambient)
+        diffuse: ToSIMD(light.diffuse)
+        specular: ToSIMD(light.specular)
         x: light.centroidX
         y: light.centroidY
         area: light.area
@@ -0,0 +1,26 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#import <Foundation/Foundation.h>
+#import <Metal/Metal.h>
+
+@class ARHDRImage;
+
+/**
+ Cube textures for image based lighting, prefiltered from a HDR environment.
+ */
+@interface ARPrefilteredEnvironment : NSObject
+
+/// Diffuse irradiance, divided by pi.
+@property (nonatomic, readonly) id<MTLTexture> irradiance;
+
+/// GGX-filtered radiance, with roughness increasing along the mip levels.
+@property (nonatomic, readonly) id<MTLTexture> specular;
+
+/**
+ Prefilters an equirectangular HDR image and uploads the results.
+ */
+- (instancetype)initWithImage:(ARHDRImage*)image device:(id<MTLDevice>)device;
+
+@end
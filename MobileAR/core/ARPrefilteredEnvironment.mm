@@ -0,0 +1,66 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#import "ARPrefilteredEnvironment.h"
+#import "ARHDRImage+cvMat.h"
+
+#include "ar/EnvironmentPrefilter.h"
+
+
+namespace {
+
+/**
+ Creates a cube texture from a chain of cube maps, one per mip level.
+ */
+id<MTLTexture> CreateTexture(
+    id<MTLDevice> device,
+    const ar::CubeMap *levels,
+    size_t count)
+{
+  const int size = levels[0][0].rows;
+  MTLTextureDescriptor *desc = [MTLTextureDescriptor
+      textureCubeDescriptorWithPixelFormat: MTLPixelFormatRGBA32Float
+      size: size
+      mipmapped: count > 1
+  ];
+  desc.mipmapLevelCount = count;
+
+  id<MTLTexture> texture = [device newTextureWithDescriptor: desc];
+  for (size_t level = 0; level < count; ++level) {
+    for (size_t face = 0; face < 6; ++face) {
+      const cv::Mat &image = levels[level][face];
+      [texture
+          replaceRegion: MTLRegionMake2D(0, 0, image.cols, image.rows)
+          mipmapLevel: level
+          slice: face
+          withBytes: image.data
+          bytesPerRow: image.step[0]
+          bytesPerImage: image.step[0] * image.rows
+      ];
+    }
+  }
+  return texture;
+}
+
+}
+
+
+@implementation ARPrefilteredEnvironment
+
+- (instancetype)initWithImage:(ARHDRImage*)image device:(id<MTLDevice>)device
+{
+  if (!(self = [super init])) {
+    return nil;
+  }
+
+  // Channels keep the order of the HDR image.
+  const auto env = ar::EnvironmentPrefilter()([image cvMat]);
+  _irradiance = CreateTexture(device, &env.irradiance, 1);
+  _irradiance.label = @"TEXIrradiance";
+  _specular = CreateTexture(device, env.specular.data(), env.specular.size());
+  _specular.label = @"TEXSpecular";
+  return self;
+}
+
+@end
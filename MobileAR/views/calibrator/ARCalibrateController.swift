@@ -201,7 +201,7 @@ class ARCalibrateController: UIViewController, ARCameraDelegate, ARCalibratorDel
   /**
    Handles a frame from the camera.
    */
-  func onCameraFrame(frame: UIImage) {
+  func onCameraFrame(frame: UIImage, time: CMTime) {
     dispatch_async(dispatch_get_main_queue()) {
       self.imageView.image = self.calibrator.findPattern(frame)
     }
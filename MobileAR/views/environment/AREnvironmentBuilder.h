@@ -56,12 +56,20 @@
 - (instancetype)initWithParams:(ARParameters*)params width:(size_t)width height:(size_t)height;
 
 /**
- Updates the preview with a frame.
+ Buffers a bracket, stitching the sharpest one of a position once the camera
+ moves on. Returns the bracket stitched into the panorama, which should be
+ previewed, or an empty array if none was. Errors refer to that bracket,
+ not to the one passed in.
 */
-- (BOOL)update:(NSArray<ARHDRFrame*>*)frames error:(NSError**)error;
+- (NSArray<ARHDRFrame*>*)update:(NSArray<ARHDRFrame*>*)frames error:(NSError**)error;
 
 /**
- Composites the panorama.
+ Stitches the sharpest bracket of the current position, returning it.
+ */
+- (NSArray<ARHDRFrame*>*)flush:(NSError**)error;
+
+/**
+ Composites the panorama out of the stitched brackets.
  */
 - (void)composite:(void(^)(NSString*, NSArray<AREnvironmentMap*>*))progressBlock;
 
@@ -14,6 +14,7 @@
 
 
 #include "ar/EnvironmentBuilder.h"
+#include "ar/FrameSelector.h"
 #include "ar/Rotation.h"
 
 
@@ -83,6 +84,12 @@ simd::float4x4 ToSIMD(const Eigen::Matrix<float, 3, 3> &r) {
 {
   // Panoramic stitcher.
   std::unique_ptr<ar::EnvironmentBuilder> builder;
+  // Selector picking the sharpest bracket at each position.
+  std::unique_ptr<ar::FrameSelector> selector;
+  // Brackets buffered by the selector, by tag.
+  NSMutableDictionary<NSNumber*, NSArray<ARHDRFrame*>*> *brackets;
+  // Tag of the next bracket.
+  uint64_t nextTag;
 }
 
 
@@ -109,31 +116,63 @@ simd::float4x4 ToSIMD(const Eigen::Matrix<float, 3, 3> &r) {
 
     // Finally.
     builder = std::make_unique<ar::EnvironmentBuilder>(width, height, k, d);
+    selector = std::make_unique<ar::FrameSelector>();
+    brackets = [[NSMutableDictionary alloc] init];
+    nextTag = 0;
   }
   
   return self;
 }
 
-- (BOOL)update:(NSArray<ARHDRFrame*>*)frames error:(NSError**)error
+- (NSArray<ARHDRFrame*>*)update:(NSArray<ARHDRFrame*>*)frames error:(NSError**)error
 {
+  // Convert the Obj-C frames to C++ structures.
+  std::vector<ar::HDRFrame> cframes;
+  for (ARHDRFrame* frame in frames) {
+    cv::Mat bgr;
+    [[frame frame] toCvMat: bgr];
+    cframes.emplace_back(
+        bgr,
+        ToEigen<float>([frame.pose proj]),
+        ToEigen<float>([frame.pose view]),
+        CMTimeGetSeconds(frame.exposure)
+    );
+  }
+
+  // Buffer the bracket, keeping the Obj-C frames to return them if selected.
+  NSNumber *tag = @(nextTag);
+  brackets[tag] = frames;
+  if (!selector->Add(cframes, nextTag++)) {
+    return @[];
+  }
+
+  // Only the new bracket can remain buffered once a position is completed.
+  NSArray<ARHDRFrame*> *current = selector->Size() > 0 ? frames : nil;
+  NSArray<ARHDRFrame*> *committed = [self commit: error];
+  [brackets removeAllObjects];
+  if (current) {
+    brackets[tag] = current;
+  }
+  return committed;
+}
 
-  try {
-    // Convert the Obj-C frames to C++ structures.
-    std::vector<ar::HDRFrame> cframes;
-    for (ARHDRFrame* frame in frames) {
-      cv::Mat bgr;
-      [[frame frame] toCvMat: bgr];
-      cframes.emplace_back(
-          bgr,
-          ToEigen<float>([frame.pose proj]),
-          ToEigen<float>([frame.pose view]),
-          CMTimeGetSeconds(frame.exposure)
-      );
-    }
 
-    // Add the image to the panorama & handle errors.
-    builder->AddFrames(cframes);
-    return YES;
+- (NSArray<ARHDRFrame*>*)flush:(NSError**)error
+{
+  NSArray<ARHDRFrame*> *committed = selector->Size() > 0 ? [self commit: error] : @[];
+  [brackets removeAllObjects];
+  return committed;
+}
+
+
+- (NSArray<ARHDRFrame*>*)commit:(NSError**)error
+{
+  // Add the sharpest bracket of the last position to the panorama.
+  uint64_t tag;
+  const auto frames = selector->Take(&tag);
+  try {
+    builder->AddFrames(frames);
+    return brackets[@(tag)];
   } catch (const ar::EnvironmentBuilderException &ex) {
     // Extract the error from C++ land.
     switch (ex.GetError()) {
@@ -153,9 +192,9 @@ simd::float4x4 ToSIMD(const Eigen::Matrix<float, 3, 3> &r) {
         *error = [NSError errorWithDomain:ARCaptureErrorDomain code:ARCaptureErrorNoGlobalMatches userInfo:nil];
         break;
     }
-    return NO;
+    return nil;
   } catch (...) {
-    return NO;
+    return nil;
   }
 }
 
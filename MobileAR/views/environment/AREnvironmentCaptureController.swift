@@ -222,7 +222,14 @@ class AREnvironmentCaptureController
         }
       }
 
-      // Create the panorama.
+      // Stitch the last position, then create the panorama.
+      do {
+        if let committed = try self.builder?.flush() {
+          self.preview(committed)
+        }
+      } catch {
+        self.reject(error)
+      }
       self.uiSpinner.startAnimating()
       self.builder?.composite() { message, images in
         self.uiMessage.text = message
@@ -275,22 +282,37 @@ class AREnvironmentCaptureController
       )
     }
     
-    // Update the enviroment builder & bail out if the image does not
-    // fit into the composited photo sphere.
+    // Update the enviroment builder & preview the bracket it stitched, if
+    // the camera left a position and the bracket fits into the photo sphere.
     do {
-      try builder?.update(frames)
-    } catch {
-      switch (ARCaptureError(rawValue: (error as NSError).code)!) {
-        case .Blurry:            print("Blurry")
-        case .NotEnoughFeatures: print("NotEnoughFeatures")
-        case .NoPairwiseMatches: print("NoPairwiseMatches")
-        case .NoGlobalMatches:   print("NoGlobalMatches")
+      if let committed = try builder?.update(frames) {
+        preview(committed)
       }
-      return
+    } catch {
+      reject(error)
+    }
+  }
+
+  /**
+   Shows a bracket stitched into the panorama.
+   */
+  func preview(frames: [ARHDRFrame]) {
+    if let frame = frames.last {
+      renderer.update(frame.frame, pose: frame.pose)
+    }
+  }
+
+  /**
+   Reports a bracket rejected by the builder. Errors refer to the position
+   the camera left, not to the latest frame.
+   */
+  func reject(error: ErrorType) {
+    switch (ARCaptureError(rawValue: (error as NSError).code)!) {
+      case .Blurry:            print("Position rejected: Blurry")
+      case .NotEnoughFeatures: print("Position rejected: NotEnoughFeatures")
+      case .NoPairwiseMatches: print("Position rejected: NoPairwiseMatches")
+      case .NoGlobalMatches:   print("Position rejected: NoGlobalMatches")
     }
-    
-    // Queue the image for compositing.
-    renderer.update(frames.last!.frame, pose: frames.last!.pose)
   }
 
   /**
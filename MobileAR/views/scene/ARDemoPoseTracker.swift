@@ -2,12 +2,16 @@
 // Licensing information can be found in the LICENSE file.
 // (C) 2015 Nandor Licker. All rights reserved.
 
+import QuartzCore
+
 /**
  Demo pose tracker that rotates the scene around the Y axis.
  */
 @objc class ARDemoPoseTracker : NSObject, ARPoseTracker {
-  /// Rotation angle around Y.
-  private var angle: Float = 0.0
+  /// Rotation speed around Y, in rad/s.
+  private let speed: Double = 0.3
+  /// Time when the rotation started.
+  private let start: CFTimeInterval = CACurrentMediaTime()
   /// Aspect ratio.
   private let aspect: Float
 
@@ -21,21 +25,22 @@
   /**
    No-op
    */
-  func trackFrame(image: UIImage) -> Bool {
+  func trackFrame(image: UIImage, time: Double) -> Bool {
     return true
   }
 
   /**
    No-op
    */
-  func trackSensor(x: CMAttitude, a: CMAcceleration, w: CMRotationRate) {
-    angle += 0.01;
+  func trackSensor(x: CMAttitude, a: CMAcceleration, w: CMRotationRate, time: Double) {
   }
 
   /**
-   Returns a pose with a perspective projection.
+   Returns a pose with a perspective projection. The angle is derived from
+   the time on the render thread, independently of the rate of the sensors.
    */
   func getPose() -> ARPose {
+    let angle = Float(fmod((CACurrentMediaTime() - start) * speed, 2.0 * M_PI))
     return ARPose(
         projMat: float4x4(
             aspect: Float(aspect),
@@ -24,14 +24,14 @@
 - (instancetype)initWithParameters:(ARParameters *)params;
 
 /**
- Updates the pose by tracking the new frame.
+ Updates the pose by tracking the new frame, captured at a given host time.
  */
-- (BOOL)trackFrame:(UIImage *)image;
+- (BOOL)trackFrame:(UIImage *)image time:(double)time;
 
 /**
- Updates the tracker using sensor measurements.
+ Updates the tracker using sensor measurements taken at a given host time.
  */
-- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w;
+- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w time:(double)time;
 
 /**
  Returns the tracked pose.
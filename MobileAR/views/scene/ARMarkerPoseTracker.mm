@@ -13,6 +13,7 @@
 #include "ar/Tracker.h"
 #include "ar/CalibTracker.h"
 #include "ar/ArUcoTracker.h"
+#include "ar/TrackerArbiter.h"
 
 
 @implementation ARMarkerPoseTracker
@@ -25,14 +26,11 @@
   cv::Mat cmat;
   cv::Mat dmat;
 
-  // Timestamp to compute frame times.
-  double prevTime;
-
-  // Active tracker.
+  // Active tracker. Set on the camera thread, read by sensor updates.
   std::shared_ptr<ar::Tracker> tracker;
 
-  // List of initial candidate trackers.
-  std::vector<std::shared_ptr<ar::Tracker>> trackers;
+  // Arbiter choosing the tracker out of the candidates.
+  std::unique_ptr<ar::TrackerArbiter> arbiter;
 }
 
 - (instancetype)initWithParameters:(ARParameters *)params
@@ -56,51 +54,55 @@
   dmat.at<double>(2, 0) = params.r1;
   dmat.at<double>(3, 0) = params.r2;
 
-  // Initialize the timers.
-  prevTime = CACurrentMediaTime();
+  // Marker maps are kept across runs, so tracking resumes instantly.
+  NSURL *mapURL = [[[NSFileManager defaultManager]
+      URLsForDirectory:NSDocumentDirectory
+      inDomains:NSUserDomainMask
+  ][0] URLByAppendingPathComponent:@"markers.bin"];
 
-  // Create a list of all tracker.
-  trackers = {
+  // Create a list of all tracker, the calibration pattern being preferred.
+  arbiter.reset(new ar::TrackerArbiter({
     std::make_shared<ar::CalibTracker>(cmat, dmat),
-    std::make_shared<ar::ArUcoTracker>(cmat, dmat)
-  };
+    std::make_shared<ar::ArUcoTracker>(cmat, dmat, [mapURL.path UTF8String])
+  }));
 
   return self;
 }
 
 
-- (BOOL)trackFrame:(UIImage *)image
+- (BOOL)trackFrame:(UIImage *)image time:(double)time
 {
-  const float dt = [self deltaTime];
-
   [image toCvMat:rgba];
-  cv::cvtColor(rgba, gray, CV_BGRA2GRAY);
 
+  // Once a tracker locks on, frames are handed to its pipeline, so the
+  // camera callback does not wait for detection and pose estimation.
   if (tracker) {
-    return tracker->TrackFrame(gray, dt);
-  } else {
-    for (const auto &t : trackers) {
-      if (t->TrackFrame(gray, dt)) {
-        tracker = t;
-        trackers.clear();
-        return true;
-      }
-    }
+    return tracker->QueueFrame(rgba, time);
+  }
+
+  // Candidates share the grayscale frame and are run concurrently.
+  cv::cvtColor(rgba, gray, CV_BGRA2GRAY);
+  auto chosen = arbiter->TrackFrame(gray, time);
+  if (!chosen) {
     return false;
   }
+  chosen->StartPipeline();
+  std::atomic_store(&tracker, chosen);
+  arbiter.reset();
+  return true;
 }
 
 
-- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w
+- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w time:(double)time
 {
   const auto q = [x quaternion];
 
-  if (tracker) {
-    tracker->TrackSensor(
+  if (auto t = std::atomic_load(&tracker)) {
+    t->TrackSensor(
         { -q.w, -q.y,  q.x,  q.z },
         {  a.x,  a.y,  a.z },
         {  w.x,  w.y,  w.z },
-        [self deltaTime]
+        time
     );
   }
 }
@@ -108,13 +110,16 @@
 
 - (ARPose *)getPose
 {
-  if (!tracker) {
+  const auto active = std::atomic_load(&tracker);
+  if (!active) {
     return nil;
   }
 
-  // Extrinsic matrix - translation + rotation.
-  const auto r = tracker->GetOrientation().toRotationMatrix();
-  const auto t = tracker->GetPosition();
+  // Extrinsic matrix - translation + rotation, from a single published state.
+  Eigen::Quaternion<float> q;
+  Eigen::Matrix<float, 3, 1> t;
+  active->GetPose(q, t);
+  const auto r = q.toRotationMatrix();
   
   // Pass the extrinsic matrix.
   NSArray<NSNumber*> *viewMat = @[
@@ -143,28 +148,18 @@
   return [[ARPose alloc] initWithViewMat:viewMat projMat:projMat];
 }
 
-/**
- Computes the time since the last update.
- */
-- (double)deltaTime
-{
-  const double time = CACurrentMediaTime();
-  const double dt = time - prevTime;
-  prevTime = time;
-  return dt;
-}
-
 /**
  Returns the markers tracked.
  */
 - (NSArray<ARMarker*>*)getMarkers
 {
-  if (!tracker) {
+  const auto active = std::atomic_load(&tracker);
+  if (!active) {
     return [[NSArray alloc] init];
   }
 
   std::vector<ARMarker*> markers;
-  for (const auto &marker : tracker->GetMarkers()) {
+  for (const auto &marker : active->GetMarkers()) {
     assert(marker.size() == 4);
     markers.emplace_back([[ARMarker alloc]
         initWithP0:CGPointMake(marker[0].x, marker[0].y)
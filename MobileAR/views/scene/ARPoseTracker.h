@@ -9,8 +9,8 @@
 
 @protocol ARPoseTracker <NSObject>
 
-- (BOOL)trackFrame:(UIImage *)image;
-- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w;
+- (BOOL)trackFrame:(UIImage *)image time:(double)time;
+- (void)trackSensor:(CMAttitude *)x a:(CMAcceleration)a w:(CMRotationRate)w time:(double)time;
 - (ARPose *)getPose;
 
 @end
@@ -50,6 +50,13 @@ extension CMDeviceMotion {
   // Motion manager used to capture attitude data.
   private var motionManager: CMMotionManager!
 
+  // Queue delivering motion samples to the tracker.
+  private let motionQueue: NSOperationQueue = {
+    let queue = NSOperationQueue()
+    queue.maxConcurrentOperationCount = 1
+    return queue
+  }()
+
   // Timer used to redraw frames.
   private var timer: CADisplayLink!
 
@@ -105,13 +112,6 @@ extension CMDeviceMotion {
       return
     }
     
-    // Start tracking orientation.
-    motionManager = CMMotionManager()
-    motionManager.deviceMotionUpdateInterval = 1 / 30.0
-    motionManager.startDeviceMotionUpdatesUsingReferenceFrame(
-        CMAttitudeReferenceFrame.XMagneticNorthZVertical
-    )
-    
     // Aspect ratio of screen.
     let aspect = Float(view.frame.width / view.frame.height)
 
@@ -123,6 +123,15 @@ extension CMDeviceMotion {
       default:               tracker = ARMarkerPoseTracker(parameters: params)
     }
 
+    // Feed all motion samples to the tracker, which integrates them cheaply.
+    motionManager = CMMotionManager()
+    motionManager.deviceMotionUpdateInterval = 1 / 100.0
+    motionManager.startDeviceMotionUpdatesUsingReferenceFrame(
+        CMAttitudeReferenceFrame.XMagneticNorthZVertical,
+        toQueue: motionQueue,
+        withHandler: onMotion
+    )
+
     // Initialize the renderer.
     renderer = try! ARSceneRenderer(view: view, environment: environment!)
 
@@ -154,6 +163,7 @@ extension CMDeviceMotion {
     super.viewWillDisappear(animated)
     timer?.invalidate()
     camera?.stop()
+    motionManager?.stopDeviceMotionUpdates()
   }
 
   /**
@@ -260,10 +270,11 @@ extension CMDeviceMotion {
   }
 
   /**
-   Processes a frame from the device's camera.
+   Processes a frame from the device's camera. Frames and motion samples are
+   both timestamped on the host clock.
    */
-  func onCameraFrame(frame: UIImage) {
-    tracker.trackFrame(frame)
+  func onCameraFrame(frame: UIImage, time: CMTime) {
+    tracker.trackFrame(frame, time: CMTimeGetSeconds(time))
     if let tracker = tracker as? ARMarkerPoseTracker {
       renderer.markers = tracker.getMarkers()
     }
@@ -271,19 +282,24 @@ extension CMDeviceMotion {
   }
 
   /**
-   Updates the tracker & renders a frame.
+   Updates the tracker with a motion sample.
    */
-  func onFrame() {
-
-    guard let motion = motionManager.deviceMotion else {
+  func onMotion(motion: CMDeviceMotion?, error: NSError?) {
+    guard let motion = motion else {
       return
     }
-    let x = motion.attitude
-    let a = motion.userAcceleration
-    let w = motion.rotationRate
-    
-    // Update the tracker.
-    tracker.trackSensor(x, a: a, w: w)
+    tracker.trackSensor(
+        motion.attitude,
+        a: motion.userAcceleration,
+        w: motion.rotationRate,
+        time: motion.timestamp
+    )
+  }
+
+  /**
+   Renders a frame with the latest pose.
+   */
+  func onFrame() {
     if let pose = tracker.getPose() {
       renderer.updatePose(pose)
     }
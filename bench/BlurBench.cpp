@@ -0,0 +1,190 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <utility>
+
+#include <opencv2/opencv.hpp>
+
+#include "ar/BlurDetector.h"
+
+
+namespace {
+
+/// Size of the synthetic frames.
+constexpr int kWidth = 1280;
+constexpr int kHeight = 720;
+/// Number of runs averaged for each measurement.
+constexpr int kRuns = 50;
+/// Standard deviations of the blur applied to the frames, in pixels.
+constexpr float kSigmas[] = { 0.0f, 1.0f, 2.0f, 4.0f };
+/// Edge threshold of both detectors.
+constexpr float kThreshold = 35.0f;
+
+
+/**
+ Creates a textured frame with sharp edges of various orientations.
+ */
+cv::Mat CreateFrame() {
+  cv::Mat frame(kHeight, kWidth, CV_8U, cv::Scalar(128));
+  cv::RNG rng(0x1234);
+  for (int i = 0; i < 200; ++i) {
+    const cv::Point centre(rng.uniform(0, kWidth), rng.uniform(0, kHeight));
+    const cv::Size axes(rng.uniform(10, 120), rng.uniform(10, 120));
+    const double angle = rng.uniform(0.0, 180.0);
+    cv::ellipse(frame, centre, axes, angle, 0, 360, cv::Scalar(rng.uniform(0, 256)), -1);
+  }
+  return frame;
+}
+
+
+/**
+ Reference detector, evaluating the transform, the edge map and the maxima
+ of each level in separate passes reading single pixels. This is how the
+ detector was implemented before the pyramid was fused.
+ */
+class ReferenceDetector {
+ public:
+  std::pair<float, float> operator() (const cv::Mat &gray) {
+    const int rows = (gray.rows >> 4) << 4;
+    const int cols = (gray.cols >> 4) << 4;
+
+    cv::Mat LL;
+    gray({0, 0, cols, rows}).convertTo(LL, CV_32F);
+    cv::Mat E[3];
+    for (int n = 0; n < 3; ++n) {
+      LL = Level(LL, E[n], 8 >> n);
+    }
+
+    int Nedge = 0, Nda = 0, Nrg = 0, Nbrg = 0;
+    for (int r = 0; r < (rows >> 4); ++r) {
+      for (int c = 0; c < (cols >> 4); ++c) {
+        const float E1 = E[0].at<float>(r, c);
+        const float E2 = E[1].at<float>(r, c);
+        const float E3 = E[2].at<float>(r, c);
+        if (E1 < kThreshold && E2 < kThreshold && E3 < kThreshold) {
+          continue;
+        }
+        Nedge++;
+        if (E1 > E2 && E2 > E3) {
+          Nda++;
+          continue;
+        }
+        if ((E1 < E2 && E2 < E3) || (E1 < E2 && E3 < E2)) {
+          Nrg++;
+          if (E1 < kThreshold) {
+            Nbrg++;
+          }
+        }
+      }
+    }
+    if (Nedge == 0 || Nrg == 0) {
+      return { 0.0f, 0.0f };
+    }
+    return {
+      static_cast<float>(Nda) / static_cast<float>(Nedge),
+      static_cast<float>(Nbrg) / static_cast<float>(Nrg)
+    };
+  }
+
+ private:
+  /**
+   Computes a level of the Haar pyramid and the maxima of its edge map over
+   windows of n pixels, returning the low pass image.
+   */
+  static cv::Mat Level(const cv::Mat &LL0, cv::Mat &EMax, int n) {
+    const int rows = LL0.rows >> 1, cols = LL0.cols >> 1;
+    cv::Mat LL1(rows, cols, CV_32F), HH(rows, cols, CV_32F);
+    cv::Mat HL(rows, cols, CV_32F), LH(rows, cols, CV_32F);
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < cols; ++c) {
+        const float p00 = LL0.at<float>((r << 1) + 0, (c << 1) + 0);
+        const float p01 = LL0.at<float>((r << 1) + 0, (c << 1) + 1);
+        const float p10 = LL0.at<float>((r << 1) + 1, (c << 1) + 0);
+        const float p11 = LL0.at<float>((r << 1) + 1, (c << 1) + 1);
+        HH.at<float>(r, c) = (p00 + p11 - p10 - p01) * 0.5f;
+        HL.at<float>(r, c) = (p00 + p10 - p11 - p01) * 0.5f;
+        LH.at<float>(r, c) = (p00 + p01 - p10 - p11) * 0.5f;
+        LL1.at<float>(r, c) = (p00 + p01 + p10 + p11) * 0.5f;
+      }
+    }
+
+    cv::Mat EMap(rows, cols, CV_32F);
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < cols; ++c) {
+        const float hh = HH.at<float>(r, c);
+        const float hl = HL.at<float>(r, c);
+        const float lh = LH.at<float>(r, c);
+        EMap.at<float>(r, c) = hh * hh + hl * hl + lh * lh;
+      }
+    }
+
+    EMax.create(rows / n, cols / n, CV_32F);
+    for (int r = 0; r < EMax.rows; ++r) {
+      for (int c = 0; c < EMax.cols; ++c) {
+        float max = std::numeric_limits<float>::min();
+        for (int dr = 0; dr < n; ++dr) {
+          for (int dc = 0; dc < n; ++dc) {
+            max = std::max(max, EMap.at<float>(r * n + dr, c * n + dc));
+          }
+        }
+        EMax.at<float>(r, c) = max;
+      }
+    }
+    return LL1;
+  }
+};
+
+
+/**
+ Returns the average time of a detector on a frame, in ms.
+ */
+template<typename T>
+double Time(T &detector, const cv::Mat &frame, std::pair<float, float> &score) {
+  score = detector(frame);
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kRuns; ++i) {
+    score = detector(frame);
+  }
+  const auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / kRuns;
+}
+
+}
+
+
+/**
+ Compares the fused pyramid of BlurDetector against the per-pixel passes it
+ replaced, on 1280x720 frames with increasing blur. Both run on one thread.
+ */
+int main() {
+  cv::setNumThreads(1);
+  const cv::Mat sharp = CreateFrame();
+
+  ar::BlurDetector fused(static_cast<int>(kThreshold));
+  ReferenceDetector reference;
+
+  std::printf(
+      "%6s %12s %12s %16s %16s\n",
+      "sigma", "ref (ms)", "fused (ms)", "ref score", "fused score"
+  );
+  for (const float sigma : kSigmas) {
+    cv::Mat frame = sharp.clone();
+    if (sigma > 0.0f) {
+      cv::GaussianBlur(sharp, frame, { 0, 0 }, sigma);
+    }
+
+    std::pair<float, float> r, f;
+    const double tr = Time(reference, frame, r);
+    const double tf = Time(fused, frame, f);
+    std::printf(
+        "%6.1f %12.3f %12.3f %7.3f / %6.3f %7.3f / %6.3f\n",
+        sigma, tr, tf, r.first, r.second, f.first, f.second
+    );
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include "Trajectory.h"
+#include "ar/KalmanFilter.h"
+
+
+namespace {
+
+/// Rate of the IMU samples, in Hz.
+constexpr int kIMURates[] = { 100, 200 };
+/// Rate of the marker poses, in Hz.
+constexpr int kMarkerRate = 30;
+/// Rate of the attitude corrections when decoupled from propagation, in Hz.
+constexpr int kAttitudeRate = 10;
+/// Simulated duration, in seconds.
+constexpr int kSeconds = 200;
+
+
+/**
+ Runs the filter over the trajectory.
+
+ @param attitude Number of IMU samples between attitude corrections.
+ @return Filter CPU time per second of tracking, in ms.
+ */
+double Run(const std::vector<bench::Sample> &samples, int rate, int attitude) {
+  const float dt = 1.0f / rate;
+  const int marker = rate / kMarkerRate;
+
+  ar::EKFPose<float> filter;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const auto &s = samples[i];
+    filter.Predict(s.w, s.a, dt);
+    if (i % attitude == 0) {
+      filter.CorrectAttitude(s.q);
+    }
+    if (i % marker == 0) {
+      filter.CorrectPose(s.q, s.t);
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  if (!filter.GetTranslation().allFinite()) {
+    std::printf("filter diverged\n");
+  }
+  return std::chrono::duration<double, std::milli>(end - start).count() / kSeconds;
+}
+
+}
+
+
+/**
+ Compares correcting the attitude with every IMU sample, as a fused
+ predict & update step would, against integrating all samples and
+ correcting periodically.
+ */
+int main() {
+  std::printf("%-8s %16s %16s\n", "IMU Hz", "fused ms/s", "split ms/s");
+  for (int rate : kIMURates) {
+    const auto samples = bench::CreateTrajectory(rate, kSeconds);
+    const double fused = Run(samples, rate, 1);
+    const double split = Run(samples, rate, rate / kAttitudeRate);
+    std::printf("%-8d %16.3f %16.3f\n", rate, fused, split);
+  }
+  return 0;
+}
@@ -0,0 +1,196 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "ar/MarkerDetector.h"
+
+
+namespace {
+
+/// Size of the synthetic frames.
+constexpr int kWidth = 1280;
+constexpr int kHeight = 720;
+/// Number of frames per configuration.
+constexpr int kFrames = 50;
+/// Number of markers per frame.
+constexpr int kMarkers = 4;
+/// Marker sides evaluated, in pixels.
+constexpr int kSides[] = { 48, 96, 160 };
+
+
+/**
+ Synthetic frame with known marker corners.
+ */
+struct Frame {
+  cv::Mat gray;
+  std::map<int, std::vector<cv::Point2f>> corners;
+};
+
+
+/**
+ Renders markers under random perspective, with blur and noise.
+ */
+Frame CreateFrame(
+    const cv::Ptr<cv::aruco::Dictionary> &dict,
+    int side,
+    std::mt19937 &gen)
+{
+  Frame frame;
+  frame.gray = cv::Mat(kHeight, kWidth, CV_8U, cv::Scalar(160));
+
+  std::uniform_real_distribution<float> jitter(-0.15f, 0.15f);
+  const int cellW = kWidth / kMarkers;
+  for (int i = 0; i < kMarkers; ++i) {
+    const int id = i * (250 / kMarkers) + static_cast<int>(gen() % (250 / kMarkers));
+
+    // Marker with a white quiet zone around it.
+    cv::Mat marker;
+    cv::aruco::drawMarker(dict, id, side, marker, 1);
+    cv::Mat source(side * 3 / 2, side * 3 / 2, CV_8U, cv::Scalar(255));
+    marker.copyTo(source({ side / 4, side / 4, side, side }));
+
+    // Perturb the corners of the marker in the destination.
+    const cv::Point2f centre(cellW * (i + 0.5f), kHeight * 0.5f);
+    const float h = side * 0.75f;
+    const std::vector<cv::Point2f> src = {
+      { 0.0f, 0.0f },
+      { h * 2.0f, 0.0f },
+      { h * 2.0f, h * 2.0f },
+      { 0.0f, h * 2.0f }
+    };
+    std::vector<cv::Point2f> dst;
+    for (const auto &p : src) {
+      dst.emplace_back(
+          centre.x + (p.x - h) * (1.0f + jitter(gen)),
+          centre.y + (p.y - h) * (1.0f + jitter(gen))
+      );
+    }
+    const cv::Mat H = cv::getPerspectiveTransform(src, dst);
+    cv::Mat warped, mask;
+    cv::warpPerspective(source, warped, H, frame.gray.size(), cv::INTER_LINEAR);
+    cv::warpPerspective(
+        cv::Mat(source.size(), CV_8U, cv::Scalar(255)),
+        mask,
+        H,
+        frame.gray.size(),
+        cv::INTER_NEAREST
+    );
+    warped.copyTo(frame.gray, mask);
+
+    // Ground truth corners of the black square.
+    const float q = side / 4.0f - 0.5f;
+    std::vector<cv::Point2f> inner = {
+      { q, q },
+      { q + side, q },
+      { q + side, q + side },
+      { q, q + side }
+    };
+    cv::perspectiveTransform(inner, inner, H);
+    frame.corners[id] = inner;
+  }
+
+  cv::GaussianBlur(frame.gray, frame.gray, { 3, 3 }, 0.8);
+  cv::Mat noise(frame.gray.size(), CV_8S);
+  cv::randn(noise, 0, 4);
+  cv::add(frame.gray, noise, frame.gray, cv::noArray(), CV_8U);
+  return frame;
+}
+
+
+/**
+ Results of a detector over a set of frames.
+ */
+struct Stats {
+  double time = 0.0;
+  double error = 0.0;
+  int found = 0;
+  int total = 0;
+};
+
+
+/**
+ Runs a detector over frames, accumulating its latency and corner error.
+ */
+template<typename F>
+Stats Evaluate(const std::vector<Frame> &frames, F detect) {
+  Stats stats;
+  for (const auto &frame : frames) {
+    std::vector<std::vector<cv::Point2f>> corners;
+    std::vector<int> ids;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    detect(frame.gray, corners, ids);
+    const auto end = std::chrono::high_resolution_clock::now();
+    stats.time += std::chrono::duration<double, std::milli>(end - start).count();
+
+    stats.total += frame.corners.size();
+    for (size_t i = 0; i < ids.size(); ++i) {
+      auto it = frame.corners.find(ids[i]);
+      if (it == frame.corners.end()) {
+        continue;
+      }
+      ++stats.found;
+      for (size_t j = 0; j < 4; ++j) {
+        const auto d = corners[i][j] - it->second[j];
+        stats.error += d.x * d.x + d.y * d.y;
+      }
+    }
+  }
+  stats.time /= frames.size();
+  stats.error = stats.found ? std::sqrt(stats.error / (stats.found * 4)) : 0.0;
+  return stats;
+}
+
+}
+
+
+int main() {
+  const auto dict = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+  const cv::Ptr<cv::aruco::DetectorParameters> params(new cv::aruco::DetectorParameters());
+  ar::MarkerDetector detector(dict, params);
+  std::mt19937 gen(0x1234);
+
+  std::printf(
+      "%6s %-8s %6s %10s %10s %10s\n",
+      "side", "method", "scale", "time (ms)", "found", "rms (px)"
+  );
+  for (const auto side : kSides) {
+    std::vector<Frame> frames;
+    for (int i = 0; i < kFrames; ++i) {
+      frames.push_back(CreateFrame(dict, side, gen));
+    }
+
+    // Scale is picked from the ground truth, as if tracked from a previous frame.
+    std::vector<std::vector<cv::Point2f>> expected;
+    for (const auto &marker : frames[0].corners) {
+      expected.push_back(marker.second);
+    }
+    const float scale = ar::MarkerDetector::Scale(expected);
+
+    const auto full = Evaluate(frames, [&](const cv::Mat &gray, auto &corners, auto &ids) {
+      cv::aruco::detectMarkers(gray, dict, corners, ids, params);
+    });
+    const auto coarse = Evaluate(frames, [&](const cv::Mat &gray, auto &corners, auto &ids) {
+      detector(gray, scale, corners, ids);
+    });
+
+    std::printf(
+        "%6d %-8s %6.2f %10.3f %4d/%-5d %10.3f\n",
+        side, "full", 1.0f, full.time, full.found, full.total, full.error
+    );
+    std::printf(
+        "%6d %-8s %6.2f %10.3f %4d/%-5d %10.3f\n",
+        side, "coarse", scale, coarse.time, coarse.found, coarse.total, coarse.error
+    );
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ar/EnvironmentPrefilter.h"
+
+
+namespace {
+
+/// Numbers of GGX samples per texel.
+constexpr int kSamples[] = { 16, 64, 256 };
+/// Number of samples of the reference the levels are compared to.
+constexpr int kReferenceSamples = 1024;
+/// Numbers of threads, 0 for all.
+constexpr int kThreads[] = { 1, 0 };
+/// Number of runs averaged for each measurement.
+constexpr int kRuns = 5;
+/// Size of the synthetic probe.
+constexpr int kWidth = 1024;
+constexpr int kHeight = 512;
+
+
+/**
+ Environment map evaluated by the benchmark.
+ */
+struct Probe {
+  std::string name;
+  cv::Mat image;
+};
+
+
+/**
+ Creates an HDR probe with a number of small, bright lights.
+ */
+cv::Mat CreateStudio() {
+  cv::Mat image(kHeight, kWidth, CV_32FC3, cv::Scalar(0.05f, 0.05f, 0.05f));
+  cv::RNG rng(0x1234);
+  for (int i = 0; i < 16; ++i) {
+    const cv::Point centre(rng.uniform(0, kWidth), rng.uniform(0, kHeight / 2));
+    const float intensity = rng.uniform(10.0f, 100.0f);
+    cv::circle(image, centre, rng.uniform(4, 16), cv::Scalar::all(intensity), -1);
+  }
+  return image;
+}
+
+
+/**
+ Relative RMS difference between the specular levels of two environments.
+ */
+double SpecularError(
+    const ar::PrefilteredEnvironment &env,
+    const ar::PrefilteredEnvironment &ref)
+{
+  double error = 0.0, norm = 0.0;
+  for (size_t level = 0; level < env.specular.size(); ++level) {
+    for (size_t face = 0; face < 6; ++face) {
+      error += std::pow(cv::norm(env.specular[level][face], ref.specular[level][face]), 2.0);
+      norm += std::pow(cv::norm(ref.specular[level][face]), 2.0);
+    }
+  }
+  return std::sqrt(error / norm);
+}
+
+}
+
+
+/**
+ Measures the time taken to prefilter environment maps with the default
+ sizes, by the number of GGX samples and threads. The noise of the specular
+ levels is measured against a prefilter taking many more samples.
+ */
+int main(int argc, char **argv) {
+  // Probes are read from the command line, a synthetic one is used otherwise.
+  std::vector<Probe> probes;
+  for (int i = 1; i < argc; ++i) {
+    cv::Mat image = cv::imread(argv[i], cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+      std::fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+    probes.push_back({ argv[i], image });
+  }
+  if (probes.empty()) {
+    probes.push_back({ "studio", CreateStudio() });
+  }
+
+  std::printf(
+      "%-24s %8s %8s %12s %12s\n",
+      "probe", "samples", "threads", "time (ms)", "spec. error"
+  );
+  for (const auto &probe : probes) {
+    const auto ref = ar::EnvironmentPrefilter(128, 6, kReferenceSamples)(probe.image);
+    for (const int samples : kSamples) {
+      const ar::EnvironmentPrefilter prefilter(128, 6, samples);
+      for (const int threads : kThreads) {
+        cv::setNumThreads(threads > 0 ? threads : cv::getNumberOfCPUs());
+
+        ar::PrefilteredEnvironment env = prefilter(probe.image);
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < kRuns; ++i) {
+          env = prefilter(probe.image);
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        std::printf(
+            "%-24s %8d %8d %12.3f %12.4f\n",
+            probe.name.c_str(),
+            samples,
+            threads > 0 ? threads : cv::getNumberOfCPUs(),
+            std::chrono::duration<double, std::milli>(end - start).count() / kRuns,
+            SpecularError(env, ref)
+        );
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include "Trajectory.h"
+#include "ar/MeasurementBuffer.h"
+
+
+namespace {
+
+/// Rate of the IMU samples, in Hz.
+constexpr int kIMURate = 100;
+/// Number of IMU samples between marker poses, about 30 Hz.
+constexpr int kMarkerInterval = 3;
+/// Number of IMU samples between attitude corrections.
+constexpr int kAttitudeInterval = 10;
+/// Delays of the marker poses, in IMU samples.
+constexpr int kDelays[] = { 0, 2, 5, 10 };
+/// Simulated duration, in seconds.
+constexpr int kSeconds = 200;
+
+typedef ar::MeasurementBuffer::Measurement Measurement;
+
+
+/**
+ Statistics of a run.
+ */
+struct Result {
+  /// RMS error of the translation, in cm.
+  double error;
+  /// Average time to add a marker pose, in us.
+  double cost;
+  /// Average number of measurements replayed per marker pose.
+  double replayed;
+};
+
+
+/**
+ Runs the filter over the trajectory, with marker poses arriving late.
+
+ @param delay  Number of IMU samples between exposure and arrival of a pose.
+ @param replay True if poses are fused at the time of exposure, false if
+               they are fused as they arrive.
+ */
+Result Run(const std::vector<bench::Sample> &samples, int delay, bool replay) {
+  ar::EKFPose<float> filter;
+  ar::MeasurementBuffer buffer;
+
+  double error = 0.0, cost = 0.0, replayed = 0.0;
+  size_t poses = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const auto &s = samples[i];
+    const double time = static_cast<double>(i) / kIMURate;
+    buffer.Add(Measurement::Inertial(
+        time, s.q, s.w, s.a, i % kAttitudeInterval == 0), filter);
+
+    // Pose of a frame exposed a few samples ago.
+    if (i >= static_cast<size_t>(delay) && (i - delay) % kMarkerInterval == 0) {
+      const auto &f = samples[i - delay];
+      const double exposed = static_cast<double>(i - delay) / kIMURate;
+
+      const auto start = std::chrono::steady_clock::now();
+      const int n = buffer.Add(
+          Measurement::Pose(replay ? exposed : time, f.q, f.t), filter);
+      const auto end = std::chrono::steady_clock::now();
+
+      cost += std::chrono::duration<double, std::micro>(end - start).count();
+      replayed += std::max(n, 0);
+      ++poses;
+    }
+
+    error += (filter.GetTranslation() - s.t).squaredNorm();
+  }
+
+  return {
+    std::sqrt(error / samples.size()),
+    cost / poses,
+    replayed / poses
+  };
+}
+
+
+/**
+ Checks that a late pose between the two oldest entries of a full buffer is
+ dropped, as the state it would be applied to is discarded to make room.
+ */
+bool CheckFullBuffer() {
+  const Eigen::Quaternionf q = Eigen::Quaternionf::Identity();
+  const Eigen::Vector3f zero = Eigen::Vector3f::Zero();
+
+  ar::EKFPose<float> filter;
+  ar::MeasurementBuffer buffer;
+  for (size_t i = 0; i < ar::MeasurementBuffer::kCapacity; ++i) {
+    buffer.Add(Measurement::Inertial(i * 0.01, q, zero, zero, true), filter);
+  }
+  if (buffer.Add(Measurement::Pose(0.005, q, zero), filter) != -1) {
+    return false;
+  }
+
+  // A pose after the two oldest entries is still applied and replayed.
+  const int replayed = buffer.Add(Measurement::Pose(0.015, q, zero), filter);
+  return replayed == static_cast<int>(ar::MeasurementBuffer::kCapacity) - 2;
+}
+
+}
+
+
+/**
+ Compares fusing delayed marker poses on arrival against rolling the filter
+ back to the time of exposure and replaying the newer IMU samples.
+ */
+int main() {
+  if (!CheckFullBuffer()) {
+    std::printf("late pose in a full buffer was not dropped\n");
+    return 1;
+  }
+
+  const auto samples = bench::CreateTrajectory(kIMURate, kSeconds);
+
+  std::printf(
+      "%-10s %14s %14s %14s %14s\n",
+      "delay ms", "arrival cm", "replay cm", "replay us", "replayed");
+  for (int delay : kDelays) {
+    const auto arrival = Run(samples, delay, false);
+    const auto replay = Run(samples, delay, true);
+    std::printf(
+        "%-10d %14.3f %14.3f %14.2f %14.1f\n",
+        delay * 1000 / kIMURate,
+        arrival.error,
+        replay.error,
+        replay.cost,
+        replay.replayed);
+  }
+  return 0;
+}
@@ -0,0 +1,523 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include <ceres/ceres.h>
+
+#include "ar/MarkerResiduals.h"
+#include "ar/Rotation.h"
+
+
+namespace {
+
+/// Size of the markers.
+constexpr double kMarkerSize = 4.6;
+/// Number of poses in the synthetic problem.
+constexpr int kPoses = 10;
+/// Number of markers in the synthetic problem.
+constexpr int kMarkers = 12;
+/// Number of residual evaluations timed.
+constexpr int kEvaluations = 200000;
+/// Number of bundle adjustment runs timed.
+constexpr int kSolves = 20;
+/// Number of random poses the Jacobians are checked at.
+constexpr int kChecks = 1000;
+/// Largest difference from automatic differentiation, relative to the value.
+constexpr double kTolerance = 1e-6;
+
+/// Corners of a marker.
+const std::vector<Eigen::Matrix<double, 3, 1>> kGrid = {
+  { -kMarkerSize / 2.0, +kMarkerSize / 2.0, 0.0 },
+  { +kMarkerSize / 2.0, +kMarkerSize / 2.0, 0.0 },
+  { +kMarkerSize / 2.0, -kMarkerSize / 2.0, 0.0 },
+  { -kMarkerSize / 2.0, -kMarkerSize / 2.0, 0.0 }
+};
+
+
+/// Keeps the results of timed evaluations alive.
+volatile double sink;
+
+
+/**
+ Reprojection error of the corners of a marker, as computed before.
+ */
+template<typename T>
+void Reproject(
+    const Eigen::Matrix<double, 4, 4> &k,
+    const std::vector<cv::Point2f> &corners,
+    const Eigen::Matrix<T, 3, 1> &pt,
+    const Eigen::Quaternion<T> &pq,
+    const Eigen::Matrix<T, 3, 1> &mt,
+    const Eigen::Quaternion<T> &mq,
+    T *pr)
+{
+  Eigen::Matrix<T, 4, 4> m = Eigen::Matrix<T, 4, 4>::Identity();
+  m.block(0, 0, 3, 3) = mq.toRotationMatrix();
+  m.block(0, 3, 3, 1) = mt;
+  Eigen::Matrix<T, 4, 4> p = Eigen::Matrix<T, 4, 4>::Identity();
+  p.block(0, 0, 3, 3) = pq.toRotationMatrix();
+  p.block(0, 3, 3, 1) = pt;
+
+  for (size_t i = 0; i < kGrid.size(); ++i) {
+    const Eigen::Matrix<T, 4, 1> gx(T(kGrid[i].x()), T(kGrid[i].y()), T(kGrid[i].z()), T(1));
+    const Eigen::Matrix<T, 4, 1> x = k.cast<T>() * p * m * gx;
+    pr[i * 2 + 0] = x.x() / x.z() - T(corners[i].x);
+    pr[i * 2 + 1] = x.y() / x.z() - T(corners[i].y);
+  }
+}
+
+
+/**
+ Automatically differentiated residual, as used before.
+ */
+struct AutoDiffResidual {
+  const Eigen::Matrix<double, 4, 4> k;
+  const std::vector<cv::Point2f> corners;
+
+  AutoDiffResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const std::vector<cv::Point2f> &corners)
+    : k(k)
+    , corners(corners)
+  {
+  }
+
+  template<typename T>
+  bool operator() (
+      const T *const ppt,
+      const T *const ppq,
+      const T *const pmt,
+      const T *const pmq,
+      T *pr) const
+  {
+    Reproject<T>(
+        k,
+        corners,
+        Eigen::Map<const Eigen::Matrix<T, 3, 1>>(ppt),
+        Eigen::Map<const Eigen::Quaternion<T>>(ppq),
+        Eigen::Map<const Eigen::Matrix<T, 3, 1>>(pmt),
+        Eigen::Map<const Eigen::Quaternion<T>>(pmq),
+        pr
+    );
+    return true;
+  }
+};
+
+
+/**
+ Automatically differentiated residual of a marker seen from a fixed pose.
+ */
+struct AutoDiffMarkerResidual {
+  const Eigen::Matrix<double, 4, 4> k;
+  const Eigen::Vector3d t;
+  const Eigen::Quaterniond q;
+  const std::vector<cv::Point2f> corners;
+
+  AutoDiffMarkerResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const Eigen::Vector3d &t,
+      const Eigen::Quaterniond &q,
+      const std::vector<cv::Point2f> &corners)
+    : k(k)
+    , t(t)
+    , q(q)
+    , corners(corners)
+  {
+  }
+
+  template<typename T>
+  bool operator() (const T *const pmt, const T *const pmq, T *pr) const {
+    Reproject<T>(
+        k,
+        corners,
+        t.cast<T>(),
+        q.cast<T>(),
+        Eigen::Map<const Eigen::Matrix<T, 3, 1>>(pmt),
+        Eigen::Map<const Eigen::Quaternion<T>>(pmq),
+        pr
+    );
+    return true;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+
+/**
+ Automatically differentiated residual of a fixed marker seen from a pose.
+ */
+struct AutoDiffPoseResidual {
+  const Eigen::Matrix<double, 4, 4> k;
+  const Eigen::Vector3d t;
+  const Eigen::Quaterniond q;
+  const std::vector<cv::Point2f> corners;
+
+  AutoDiffPoseResidual(
+      const Eigen::Matrix<double, 4, 4> &k,
+      const Eigen::Vector3d &t,
+      const Eigen::Quaterniond &q,
+      const std::vector<cv::Point2f> &corners)
+    : k(k)
+    , t(t)
+    , q(q)
+    , corners(corners)
+  {
+  }
+
+  template<typename T>
+  bool operator() (const T *const ppt, const T *const ppq, T *pr) const {
+    Reproject<T>(
+        k,
+        corners,
+        Eigen::Map<const Eigen::Matrix<T, 3, 1>>(ppt),
+        Eigen::Map<const Eigen::Quaternion<T>>(ppq),
+        t.cast<T>(),
+        q.cast<T>(),
+        pr
+    );
+    return true;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+
+/**
+ Automatically differentiated prior on the position of a marker.
+ */
+struct AutoDiffPrior {
+  const Eigen::Vector3d t;
+  const Eigen::Matrix3d weight;
+
+  AutoDiffPrior(const Eigen::Vector3d &t, const Eigen::Matrix3d &covariance)
+    : t(t)
+    , weight(covariance.llt().matrixL().solve(Eigen::Matrix3d::Identity()))
+  {
+  }
+
+  template<typename T>
+  bool operator() (const T *const pmt, T *pr) const {
+    Eigen::Map<Eigen::Matrix<T, 3, 1>> r(pr);
+    r = weight.cast<T>() * (Eigen::Map<const Eigen::Matrix<T, 3, 1>>(pmt) - t.cast<T>());
+    return true;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+
+/**
+ Synthetic scene: markers on a wall, seen from poses in front of it.
+ */
+struct Scene {
+  Eigen::Matrix<double, 4, 4> k;
+  std::vector<std::pair<Eigen::Quaterniond, Eigen::Vector3d>> poses;
+  std::vector<std::pair<Eigen::Quaterniond, Eigen::Vector3d>> markers;
+  std::vector<std::tuple<int, int, std::vector<cv::Point2f>>> observations;
+};
+
+
+Scene CreateScene(std::mt19937 &gen) {
+  std::normal_distribution<double> noise(0.0, 1.0);
+  Scene scene;
+
+  scene.k = Eigen::Matrix<double, 4, 4>::Identity();
+  scene.k(0, 0) = 1100.0;
+  scene.k(1, 1) = 1100.0;
+  scene.k(0, 2) = 640.0;
+  scene.k(1, 2) = 360.0;
+
+  for (int i = 0; i < kMarkers; ++i) {
+    scene.markers.emplace_back(
+        Eigen::Quaterniond(Eigen::AngleAxisd(0.2 * noise(gen), Eigen::Vector3d::UnitZ())),
+        Eigen::Vector3d((i % 4) * 15.0 - 22.5, (i / 4) * 15.0 - 15.0, 0.0)
+    );
+  }
+  for (int i = 0; i < kPoses; ++i) {
+    scene.poses.emplace_back(
+        Eigen::Quaterniond(Eigen::AngleAxisd(0.1 * noise(gen), Eigen::Vector3d::UnitY())),
+        Eigen::Vector3d(2.0 * noise(gen), 2.0 * noise(gen), 80.0 + 5.0 * noise(gen))
+    );
+  }
+
+  // Project all markers into all poses, adding pixel noise.
+  for (int p = 0; p < kPoses; ++p) {
+    const auto &pose = scene.poses[p];
+    for (int m = 0; m < kMarkers; ++m) {
+      const auto &marker = scene.markers[m];
+      std::vector<cv::Point2f> corners;
+      for (const auto &g : kGrid) {
+        const Eigen::Vector3d c = pose.first * (marker.first * g + marker.second) + pose.second;
+        const Eigen::Vector3d x = scene.k.block<3, 3>(0, 0) * c;
+        corners.emplace_back(x.x() / x.z() + 0.5 * noise(gen), x.y() / x.z() + 0.5 * noise(gen));
+      }
+      scene.observations.emplace_back(p, m, corners);
+    }
+  }
+
+  // Perturb the initial estimates.
+  for (auto &pose : scene.poses) {
+    pose.second += Eigen::Vector3d(noise(gen), noise(gen), noise(gen));
+  }
+  for (auto &marker : scene.markers) {
+    marker.second += 0.5 * Eigen::Vector3d(noise(gen), noise(gen), noise(gen));
+  }
+  return scene;
+}
+
+
+ceres::CostFunction *CreateCost(bool analytic, const Scene &scene, const std::vector<cv::Point2f> &c) {
+  if (analytic) {
+    return new ar::MarkerPoseResidual(scene.k, kGrid, c);
+  } else {
+    return new ceres::AutoDiffCostFunction<AutoDiffResidual, 8, 3, 4, 3, 4>(
+        new AutoDiffResidual(scene.k, c)
+    );
+  }
+}
+
+
+/**
+ Measures residual + Jacobian evaluations per second.
+ */
+double Throughput(bool analytic, const Scene &scene) {
+  const auto &obs = scene.observations[0];
+  std::unique_ptr<ceres::CostFunction> cost(CreateCost(analytic, scene, std::get<2>(obs)));
+
+  auto pose = scene.poses[std::get<0>(obs)];
+  auto marker = scene.markers[std::get<1>(obs)];
+  double const *params[] = {
+    pose.second.data(), pose.first.coeffs().data(),
+    marker.second.data(), marker.first.coeffs().data()
+  };
+  double r[8], jpt[24], jpq[32], jmt[24], jmq[32];
+  double *J[] = { jpt, jpq, jmt, jmq };
+
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kEvaluations; ++i) {
+    cost->Evaluate(params, r, J);
+    sink = r[0] + jmq[0];
+  }
+  const auto end = std::chrono::high_resolution_clock::now();
+  return kEvaluations / std::chrono::duration<double>(end - start).count();
+}
+
+
+/**
+ Evaluates two cost functions with the same parameters, returning the
+ largest difference between their residuals and Jacobians, relative to the
+ magnitude of the automatically differentiated value. Returns infinity if
+ either evaluation fails.
+ */
+double Compare(
+    const ceres::CostFunction &analytic,
+    const ceres::CostFunction &autodiff,
+    double const *const *params)
+{
+  const auto &sizes = autodiff.parameter_block_sizes();
+  const int rows = autodiff.num_residuals();
+
+  std::vector<double> ra(rows), rb(rows);
+  std::vector<std::vector<double>> ja, jb;
+  std::vector<double*> pa, pb;
+  for (const auto size : sizes) {
+    ja.emplace_back(rows * size);
+    jb.emplace_back(rows * size);
+  }
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    pa.push_back(ja[i].data());
+    pb.push_back(jb[i].data());
+  }
+  if (!analytic.Evaluate(params, ra.data(), pa.data()) ||
+      !autodiff.Evaluate(params, rb.data(), pb.data()))
+  {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  auto error = [](double a, double b) {
+    return std::abs(a - b) / std::max(1.0, std::abs(b));
+  };
+  double max = 0.0;
+  for (int i = 0; i < rows; ++i) {
+    max = std::max(max, error(ra[i], rb[i]));
+  }
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    for (size_t j = 0; j < ja[i].size(); ++j) {
+      max = std::max(max, error(ja[i][j], jb[i][j]));
+    }
+  }
+  return max;
+}
+
+
+/**
+ Compares the residuals and all Jacobian blocks of the analytic residuals
+ against automatic differentiation, at random poses and markers. Returns
+ the largest error of each residual.
+ */
+std::array<double, 4> CheckJacobians(std::mt19937 &gen, const Scene &scene) {
+  std::normal_distribution<double> noise(0.0, 1.0);
+  auto rotation = [&]() {
+    return Eigen::Quaterniond(
+        noise(gen), noise(gen), noise(gen), noise(gen)
+    ).normalized();
+  };
+
+  std::array<double, 4> errors{{ 0.0, 0.0, 0.0, 0.0 }};
+  for (int i = 0; i < kChecks; ++i) {
+    // Markers are rotated arbitrarily, but placed in front of the camera.
+    Eigen::Quaterniond pq = rotation();
+    Eigen::Vector3d pt(10.0 * noise(gen), 10.0 * noise(gen), 80.0 + 10.0 * noise(gen));
+    Eigen::Quaterniond mq = rotation();
+    Eigen::Vector3d mt = pq.inverse() * (-pt + Eigen::Vector3d(
+        10.0 * noise(gen), 10.0 * noise(gen), 80.0 + 10.0 * noise(gen)
+    ));
+    const auto &corners = std::get<2>(scene.observations[i % scene.observations.size()]);
+
+    {
+      const ar::MarkerPoseResidual analytic(scene.k, kGrid, corners);
+      const ceres::AutoDiffCostFunction<AutoDiffResidual, 8, 3, 4, 3, 4> autodiff(
+          new AutoDiffResidual(scene.k, corners)
+      );
+      double const *params[] = {
+        pt.data(), pq.coeffs().data(), mt.data(), mq.coeffs().data()
+      };
+      errors[0] = std::max(errors[0], Compare(analytic, autodiff, params));
+    }
+    {
+      const ar::MarkerResidual analytic(scene.k, pt, pq, kGrid, corners);
+      const ceres::AutoDiffCostFunction<AutoDiffMarkerResidual, 8, 3, 4> autodiff(
+          new AutoDiffMarkerResidual(scene.k, pt, pq, corners)
+      );
+      double const *params[] = { mt.data(), mq.coeffs().data() };
+      errors[1] = std::max(errors[1], Compare(analytic, autodiff, params));
+    }
+    {
+      const ar::PoseResidual analytic(scene.k, mt, mq, kGrid, corners);
+      const ceres::AutoDiffCostFunction<AutoDiffPoseResidual, 8, 3, 4> autodiff(
+          new AutoDiffPoseResidual(scene.k, mt, mq, corners)
+      );
+      double const *params[] = { pt.data(), pq.coeffs().data() };
+      errors[2] = std::max(errors[2], Compare(analytic, autodiff, params));
+    }
+    {
+      const Eigen::Vector3d prior = mt + Eigen::Vector3d(noise(gen), noise(gen), noise(gen));
+      const Eigen::Matrix3d a = Eigen::Matrix3d::NullaryExpr([&]() { return noise(gen); });
+      const Eigen::Matrix3d covariance = a * a.transpose() + 0.1 * Eigen::Matrix3d::Identity();
+      const ar::PositionPrior analytic(prior, covariance);
+      const ceres::AutoDiffCostFunction<AutoDiffPrior, 3, 3> autodiff(
+          new AutoDiffPrior(prior, covariance)
+      );
+      double const *params[] = { mt.data() };
+      errors[3] = std::max(errors[3], Compare(analytic, autodiff, params));
+    }
+  }
+  return errors;
+}
+
+
+/**
+ Runs bundle adjustment with the same settings as the tracker.
+ */
+std::pair<double, double> Solve(bool analytic, const Scene &scene) {
+  auto poses = scene.poses;
+  auto markers = scene.markers;
+
+  ceres::Problem problem;
+  for (const auto &obs : scene.observations) {
+    auto &pose = poses[std::get<0>(obs)];
+    auto &marker = markers[std::get<1>(obs)];
+    problem.AddResidualBlock(
+        CreateCost(analytic, scene, std::get<2>(obs)),
+        nullptr,
+        pose.second.data(),
+        pose.first.coeffs().data(),
+        marker.second.data(),
+        marker.first.coeffs().data()
+    );
+  }
+  problem.SetParameterBlockConstant(markers[0].first.coeffs().data());
+  problem.SetParameterBlockConstant(markers[0].second.data());
+
+  auto *qsParam = new ar::QuaternionParametrization();
+  for (auto &pose : poses) {
+    problem.SetParameterization(pose.first.coeffs().data(), qsParam);
+  }
+  for (size_t i = 1; i < markers.size(); ++i) {
+    problem.SetParameterization(markers[i].first.coeffs().data(), qsParam);
+  }
+
+  ceres::Solver::Summary summary;
+  ceres::Solver::Options options;
+  options.use_inner_iterations = true;
+  options.use_nonmonotonic_steps = true;
+  options.preconditioner_type = ceres::SCHUR_JACOBI;
+  options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+  options.max_num_iterations = 30;
+  options.gradient_tolerance = 1e-3;
+  options.function_tolerance = 1e-3;
+
+  const auto start = std::chrono::high_resolution_clock::now();
+  ceres::Solve(options, &problem, &summary);
+  const auto end = std::chrono::high_resolution_clock::now();
+  return {
+    std::chrono::duration<double, std::milli>(end - start).count(),
+    summary.final_cost
+  };
+}
+
+}
+
+
+int main() {
+  std::mt19937 gen(42);
+  const Scene scene = CreateScene(gen);
+
+  // Analytic Jacobians must match automatic differentiation.
+  const auto errors = CheckJacobians(gen, scene);
+  const char *names[] = {
+    "MarkerPoseResidual", "MarkerResidual", "PoseResidual", "PositionPrior"
+  };
+  bool valid = true;
+  for (size_t i = 0; i < errors.size(); ++i) {
+    std::printf("%-20s max error %.3g\n", names[i], errors[i]);
+    valid = valid && errors[i] <= kTolerance;
+  }
+  if (!valid) {
+    std::printf("FAIL: analytic Jacobians differ from automatic differentiation\n");
+    return 1;
+  }
+  std::printf("\n");
+
+  std::printf("%-10s %14s %10s %12s\n", "residual", "evals/s", "BA ms", "final cost");
+  for (bool analytic : { false, true }) {
+    const double evals = Throughput(analytic, scene);
+
+    double ms = 0.0, cost = 0.0;
+    for (int i = 0; i < kSolves; ++i) {
+      const auto r = Solve(analytic, scene);
+      ms += r.first / kSolves;
+      cost = r.second;
+    }
+
+    std::printf(
+        "%-10s %14.0f %10.2f %12.4f\n",
+        analytic ? "analytic" : "autodiff",
+        evals,
+        ms,
+        cost
+    );
+  }
+  return 0;
+}
@@ -0,0 +1,193 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ar/KMeansSampler.h"
+#include "ar/MedianCutSampler.h"
+#include "ar/SHProjector.h"
+#include "ar/VarianceCutSampler.h"
+
+
+namespace {
+
+/// Depths the samplers are evaluated at.
+constexpr size_t kDepths[] = { 2, 4, 6, 8 };
+/// Number of runs averaged for each measurement.
+constexpr int kRuns = 10;
+/// Size of the synthetic probes.
+constexpr int kWidth = 1024;
+constexpr int kHeight = 512;
+
+
+/**
+ Light probe evaluated by the benchmark.
+ */
+struct Probe {
+  std::string name;
+  cv::Mat image;
+};
+
+
+/**
+ Creates an LDR probe with a sky gradient and a sun.
+ */
+cv::Mat CreateSky() {
+  cv::Mat image(kHeight, kWidth, CV_8UC4);
+  for (int r = 0; r < kHeight; ++r) {
+    const float t = static_cast<float>(r) / kHeight;
+    for (int c = 0; c < kWidth; ++c) {
+      auto &pix = image.at<cv::Vec4b>(r, c);
+      if (t < 0.5f) {
+        pix = cv::Vec4b(100 + 80 * t, 150 + 100 * t, 255, 255);
+      } else {
+        pix = cv::Vec4b(80, 70, 60, 255);
+      }
+    }
+  }
+  cv::circle(image, { kWidth / 3, kHeight / 5 }, 12, { 255, 255, 240, 255 }, -1);
+  return image;
+}
+
+
+/**
+ Creates an HDR probe with a number of small, bright lights.
+ */
+cv::Mat CreateStudio() {
+  cv::Mat image(kHeight, kWidth, CV_32FC3, cv::Scalar(0.05f, 0.05f, 0.05f));
+  cv::RNG rng(0x1234);
+  for (int i = 0; i < 16; ++i) {
+    const cv::Point centre(rng.uniform(0, kWidth), rng.uniform(0, kHeight / 2));
+    const float intensity = rng.uniform(10.0f, 100.0f);
+    cv::circle(image, centre, rng.uniform(4, 16), cv::Scalar::all(intensity), -1);
+  }
+  return image;
+}
+
+
+/**
+ Relative RMS error of the diffuse irradiance due to a set of lights.
+
+ The reference is computed from the spherical harmonic projection of the
+ probe. Lights are rescaled to best fit the reference, since samplers only
+ preserve relative intensities.
+ */
+double IrradianceError(
+    const std::vector<cv::Vec3f> &sh,
+    const std::vector<ar::LightSource> &lights)
+{
+  // Normals evenly distributed on a Fibonacci sphere.
+  constexpr int kNormals = 256;
+  double sumTL = 0.0, sumLL = 0.0, sumTT = 0.0;
+  std::vector<std::pair<double, double>> values;
+  for (int i = 0; i < kNormals; ++i) {
+    const double z = 1.0 - (2.0 * i + 1.0) / kNormals;
+    const double r = std::sqrt(1.0 - z * z);
+    const double phi = i * M_PI * (3.0 - std::sqrt(5.0));
+    const double x = r * std::cos(phi), y = r * std::sin(phi);
+
+    const auto e = ar::SHProjector::evaluate(sh, x, y, z);
+    const double truth = e[0] * 0.2125 + e[1] * 0.7154 + e[2] * 0.0721;
+
+    double approx = 0.0;
+    for (const auto &light : lights) {
+      const double cos = -(
+          x * light.direction.x() +
+          y * light.direction.y() +
+          z * light.direction.z()
+      );
+      const auto &d = light.diffuse;
+      approx += std::max(cos, 0.0) * (d.x() * 0.2125 + d.y() * 0.7154 + d.z() * 0.0721);
+    }
+    values.emplace_back(truth, approx);
+    sumTL += truth * approx;
+    sumLL += approx * approx;
+    sumTT += truth * truth;
+  }
+
+  const double scale = sumLL > 0.0 ? sumTL / sumLL : 0.0;
+  double error = 0.0;
+  for (const auto &v : values) {
+    error += (v.first - scale * v.second) * (v.first - scale * v.second);
+  }
+  return std::sqrt(error / sumTT);
+}
+
+
+/**
+ Measures the average time of a function in milliseconds.
+ */
+double Measure(const std::function<void()> &f) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kRuns; ++i) {
+    f();
+  }
+  const auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / kRuns;
+}
+
+}
+
+
+int main(int argc, char **argv) {
+  // Probes are read from the command line, synthetic ones are used otherwise.
+  std::vector<Probe> probes;
+  for (int i = 1; i < argc; ++i) {
+    cv::Mat image = cv::imread(argv[i], cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+      std::fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+    if (image.channels() == 3) {
+      cv::cvtColor(image, image, CV_BGR2RGB);
+    } else if (image.channels() == 4) {
+      cv::cvtColor(image, image, CV_BGRA2RGBA);
+    }
+    probes.push_back({ argv[i], image });
+  }
+  if (probes.empty()) {
+    probes.push_back({ "sky", CreateSky() });
+    probes.push_back({ "studio", CreateStudio() });
+  }
+
+  std::printf(
+      "%-24s %-8s %6s %12s %12s %12s\n",
+      "probe", "sampler", "depth", "build (ms)", "query (ms)", "irr. error"
+  );
+  for (const auto &probe : probes) {
+    const auto sh = ar::SHProjector::irradiance(ar::SHProjector(3, 256)(probe.image));
+    for (const auto depth : kDepths) {
+      // Construction computes the luminance map and the moment tables, while
+      // sampling builds the cut tree. Queries reuse the tree.
+      auto run = [&](const char *name, auto create) {
+        size_t count = 0;
+        const double build = Measure([&] {
+          auto sampler = create();
+          count += sampler().size();
+        });
+        auto sampler = create();
+        const double error = IrradianceError(sh, sampler());
+        const double query = Measure([&] {
+          count += sampler(depth).size();
+        });
+        std::printf(
+            "%-24s %-8s %6zu %12.3f %12.3f %12.4f\n",
+            probe.name.c_str(), name, depth, build, query, error
+        );
+        return count;
+      };
+      run("median", [&] { return ar::MedianCutSampler(depth, probe.image); });
+      run("variance", [&] { return ar::VarianceCutSampler(depth, probe.image); });
+      run("kmeans", [&] { return ar::KMeansSampler(depth, probe.image); });
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "ar/ArUcoTracker.h"
+
+#if !defined(__GLIBC__)
+#error "Allocations are counted by wrapping the glibc allocator."
+#endif
+
+
+namespace {
+
+/// Size of the synthetic frames.
+constexpr int kWidth = 1280;
+constexpr int kHeight = 720;
+/// Side of the rendered markers, in pixels.
+constexpr int kSide = 120;
+/// Number of frames before measurements start.
+constexpr int kWarmup = 60;
+/// Number of measured frames.
+constexpr int kFrames = 300;
+
+/// Number of allocations made by the thread tracking frames while counting.
+/// Other threads, such as bundle adjustment, are not counted.
+thread_local size_t allocations = 0;
+/// Enables counting on the current thread.
+thread_local bool counting = false;
+
+
+/**
+ Records an allocation.
+ */
+inline void Count() {
+  if (counting) {
+    ++allocations;
+  }
+}
+
+
+/**
+ Renders a row of markers on a grey background.
+ */
+cv::Mat CreateBoard(const cv::Ptr<cv::aruco::Dictionary> &dict) {
+  cv::Mat board(kHeight, kWidth, CV_8U, cv::Scalar(160));
+  for (int i = 0; i < 4; ++i) {
+    cv::Mat marker;
+    cv::aruco::drawMarker(dict, i, kSide, marker, 1);
+    cv::Mat source(kSide * 3 / 2, kSide * 3 / 2, CV_8U, cv::Scalar(255));
+    marker.copyTo(source({ kSide / 4, kSide / 4, kSide, kSide }));
+    source.copyTo(board({
+        kWidth * (2 * i + 1) / 8 - source.cols / 2,
+        kHeight / 2 - source.rows / 2,
+        source.cols,
+        source.rows
+    }));
+  }
+  cv::GaussianBlur(board, board, { 3, 3 }, 0.8);
+  return board;
+}
+
+}
+
+
+// The allocator entry points are replaced, forwarding to glibc. This counts
+// operator new, which is built on malloc, as well as cv::fastMalloc and Eigen.
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+  Count();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  Count();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  Count();
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  Count();
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  Count();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  Count();
+  if (void *mem = __libc_memalign(alignment, size)) {
+    *ptr = mem;
+    return 0;
+  }
+  return ENOMEM;
+}
+
+}
+
+
+/**
+ Counts heap allocations on the frame path of ArUcoTracker in steady state,
+ failing if a frame which tracks corners allocates. Two kinds of work are
+ exempt: frames which run the ArUco detector, every few frames or when
+ tracking is lost, and bundle adjustment, which runs on its own thread.
+ */
+int main() {
+
+  // Run OpenCV on the calling thread, so all of its work is counted.
+  cv::setNumThreads(0);
+
+  cv::Mat k = cv::Mat::zeros(3, 3, CV_64F);
+  k.at<double>(0, 0) = 1100.0;
+  k.at<double>(1, 1) = 1100.0;
+  k.at<double>(0, 2) = kWidth / 2.0;
+  k.at<double>(1, 2) = kHeight / 2.0;
+  k.at<double>(2, 2) = 1.0;
+  const cv::Mat d = cv::Mat::zeros(4, 1, CV_64F);
+
+  const auto dict = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+  const cv::Mat board = CreateBoard(dict);
+  ar::ArUcoTracker tracker(k, d);
+
+  // Move the camera slowly, so corners are tracked between detections. All
+  // buffers written while counting are allocated upfront.
+  cv::Mat frame(board.size(), board.type());
+  cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0, 0, 0, 1, 0);
+  std::vector<size_t> counts, detected;
+  std::vector<double> times;
+  counts.reserve(kFrames);
+  detected.reserve(kFrames);
+  times.reserve(kFrames);
+  size_t found = 0;
+  for (int i = 0; i < kWarmup + kFrames; ++i) {
+    shift.at<double>(0, 2) = 4.0 * std::sin(i * 0.05);
+    shift.at<double>(1, 2) = 3.0 * std::cos(i * 0.07);
+    cv::warpAffine(board, frame, shift, board.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+    // Only the frame path is counted.
+    const size_t detections = tracker.GetDetections();
+    const size_t before = allocations;
+    counting = i >= kWarmup;
+    const auto start = std::chrono::high_resolution_clock::now();
+    const bool tracked = tracker.TrackFrame(frame, (i + 1) / 30.0);
+    const auto end = std::chrono::high_resolution_clock::now();
+    counting = false;
+
+    if (i < kWarmup) {
+      continue;
+    }
+    found += tracked ? 1 : 0;
+    const double time = std::chrono::duration<double, std::milli>(end - start).count();
+    if (tracker.GetDetections() != detections) {
+      detected.push_back(allocations - before);
+    } else {
+      counts.push_back(allocations - before);
+      times.push_back(time);
+    }
+  }
+
+  if (found == 0 || counts.empty()) {
+    std::printf("tracking failed\n");
+    return 1;
+  }
+
+  // Most frames only follow corners, detection runs periodically. Frames
+  // which only follow corners must be free of allocations.
+  std::sort(counts.begin(), counts.end());
+  std::sort(times.begin(), times.end());
+  const size_t zero = std::count(counts.begin(), counts.end(), 0);
+
+  std::printf("tracked frames:         %zu / %d\n", found, kFrames);
+  std::printf("corner tracking frames: %zu, allocation-free: %zu\n", counts.size(), zero);
+  std::printf("allocations med/max:    %zu / %zu\n",
+      counts[counts.size() / 2], counts.back());
+  std::printf("median frame time:      %.3f ms\n", times[times.size() / 2]);
+  if (!detected.empty()) {
+    std::printf("detection frames:       %zu, allocations total: %zu (exempt)\n",
+        detected.size(), std::accumulate(detected.begin(), detected.end(), size_t(0)));
+  }
+
+  if (counts.back() > 0) {
+    std::printf("FAIL: corner tracking frames allocate up to %zu times\n", counts.back());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+// This file is part of the MobileAR Project.
+// Licensing information can be found in the LICENSE file.
+// (C) 2015 Nandor Licker. All rights reserved.
+
+#pragma once
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <Eigen/Eigen>
+
+
+namespace bench {
+
+/**
+ Sensor sample of a simulated trajectory.
+ */
+struct Sample {
+  /// Orientation of the camera.
+  Eigen::Quaternionf q;
+  /// Angular velocity, held until the next sample.
+  Eigen::Vector3f w;
+  /// Acceleration in the camera frame.
+  Eigen::Vector3f a;
+  /// Translation of the view transform.
+  Eigen::Vector3f t;
+};
+
+
+/**
+ Orientation of the simulated camera at a point in time.
+ */
+inline Eigen::Quaternionf Orientation(float t) {
+  const Eigen::Vector3f axis = Eigen::Vector3f(
+      std::sin(t * 0.7f), std::cos(t * 0.5f), 1.0f).normalized();
+  return Eigen::Quaternionf(Eigen::AngleAxisf(0.3f * std::sin(t), axis));
+}
+
+
+/**
+ Generates a camera swaying in front of the markers, with noisy sensors.
+
+ The angular velocity is the rotation between consecutive samples, matching
+ the left-multiplied orientation of the filter, so prediction is driven by
+ the actual motion of the camera.
+
+ @param rate    Rate of the samples, in Hz.
+ @param seconds Duration of the trajectory.
+ */
+inline std::vector<Sample> CreateTrajectory(int rate, int seconds) {
+  std::mt19937 gen(42);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+
+  std::vector<Sample> samples;
+  for (int i = 0; i < seconds * rate; ++i) {
+    const float dt = 1.0f / rate;
+    const float t = static_cast<float>(i) * dt;
+    const Eigen::Quaternionf q = Orientation(t);
+    const Eigen::AngleAxisf dq(Orientation(t + dt) * q.inverse());
+    const Eigen::Vector3f p(10.0f * std::sin(t), 5.0f * std::cos(t), -40.0f);
+    const Eigen::Vector3f a(-10.0f * std::sin(t), -5.0f * std::cos(t), 0.0f);
+
+    samples.push_back({
+      q,
+      dq.axis() * dq.angle() / dt +
+          Eigen::Vector3f(noise(gen), noise(gen), noise(gen)) * 0.01f,
+      q * a + Eigen::Vector3f(noise(gen), noise(gen), noise(gen)) * 10.0f,
+      -(q * p)
+    });
+  }
+  return samples;
+}
+
+}